@@ -0,0 +1,1304 @@
+#include <FumblyNet.h>
+#include <ctime>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Loopback tcp benchmarks of the io backend picked at configure time (FUMBLY_IO_BACKEND)
+//     NetBench [messages] [body bytes] [port]         round trip latency and one way throughput
+//     NetBench pool [messages] [body bytes] [port]    one way throughput through a ClientPool of 1, 2, 4 and 8 connections
+//     NetBench rpc [calls] [port]                     ClientInterface::Call latency and rate at pipeline depth 1, 16 and 256
+//     NetBench delivery [messages] [port]             per message latency and process cpu of wait + drain and of callback delivery
+//     NetBench transports [messages] [body bytes]     round trip latency and throughput over tcp loopback, unix socket, socket pair and in process
+//     NetBench lanes [pings] [port]                   ping latency while the server saturates the link with bulk data, one FIFO lane vs priority lanes
+//     NetBench timers [connections]                   timer wheel schedule/advance cost and timer bytes per connection
+//     NetBench idle [connections] [port]              server memory per idle connection (Linux)
+//     NetBench shm [messages] [body bytes]            round trip latency and throughput over a shared memory link and tcp loopback (Linux)
+//     NetBench storm [clients] [threads] [port]       raw handshake connect storm, connections accepted and validated per second (Linux)
+//     NetBench log [connections] [port]               caller cost of a log line and a connect storm with logging on, against std::cout (Linux)
+//     NetBench cluster [nodes] [broadcasts] [port]    broadcast latency across nodes, one process per node (Linux)
+// Syscalls per message: run under `strace -f -c` (epoll) or `perf stat -e 'syscalls:sys_enter_*'` (both backends)
+// and divide the totals by the message count printed
+enum class BenchMsg : uint32_t
+{
+    Ping,
+    Data,
+    Done,
+    Broadcast,
+    Report,
+    Request
+};
+
+template<typename Protocol>
+class BenchServerOf : public Fumbly::ServerInterface<BenchMsg, Protocol>
+{
+public:
+    using Fumbly::ServerInterface<BenchMsg, Protocol>::ServerInterface;
+
+    std::atomic<uint64_t> nReceived = 0;
+    std::atomic<uint32_t> nAccepted = 0;
+    std::atomic<uint32_t> nValidated = 0;
+
+    void OnClientValidated(std::shared_ptr<Fumbly::Connection<BenchMsg, Protocol>> client) override
+    {
+        nValidated++;
+    }
+
+protected:
+    bool OnClientConnect(std::shared_ptr<Fumbly::Connection<BenchMsg, Protocol>> client) override
+    {
+        nAccepted++;
+        return true;
+    }
+
+    void OnMessage(std::shared_ptr<Fumbly::Connection<BenchMsg, Protocol>> client, Fumbly::Message<BenchMsg> msg) override
+    {
+        switch(msg.Header.Id)
+        {
+            case BenchMsg::Data:
+                nReceived++;
+                break;
+            case BenchMsg::Ping:
+            case BenchMsg::Done:
+                client->Send(msg);
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+using BenchServer = BenchServerOf<asio::ip::tcp>;
+
+static const char* BackendName()
+{
+#if defined(ASIO_HAS_IO_URING) && defined(ASIO_DISABLE_EPOLL)
+    return "io_uring";
+#elif defined(_WIN32)
+    return "iocp";
+#else
+    return "epoll";
+#endif
+}
+
+// Value at fraction p of the sorted values, 0 if there are none
+static double Percentile(std::vector<double>& values, double p)
+{
+    if(values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, size_t(p * values.size()))];
+}
+
+// User + system cpu time of every thread of the process so far
+static double ProcessCpuSeconds()
+{
+#if defined(__linux__)
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return double(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Blocks until the next message from the server arrives
+static Fumbly::Message<BenchMsg> WaitForReply(Fumbly::ClientInterface<BenchMsg>& client)
+{
+    while(!client.WaitForMessages(std::chrono::milliseconds(100))) {}
+    return client.Incoming().PopFront().Msg;
+}
+
+// Calls server.Update on its own thread while the runner lives. Update sleeps until a message arrives, so on
+// destruction the runner sends one more, from its own tcp client on port unless a wake is given. Nothing waits for the
+// echo, the thread may see the flag and leave before that message is read. Declare the runner after the server and
+// any client its wake uses, so it is torn down first
+template<typename Server>
+class BenchServerRunner
+{
+public:
+    BenchServerRunner(Server& server, std::function<void()> fnWake)
+        :m_Server(server), m_FnWake(std::move(fnWake)), m_Thread([this]() {
+            while(m_bRunning)
+                m_Server.Update(-1, true);
+        })
+    {
+    }
+
+    BenchServerRunner(Server& server, uint16_t port)
+        :BenchServerRunner(server, [this, port]() {
+            if(m_Waker.Connect("127.0.0.1", port))
+                m_Waker.Send(Ping());
+        })
+    {
+    }
+
+    ~BenchServerRunner()
+    {
+        m_bRunning = false;
+        m_FnWake();
+        m_Thread.join();
+    }
+
+private:
+    static Fumbly::Message<BenchMsg> Ping()
+    {
+        Fumbly::Message<BenchMsg> ping;
+        ping.Header.Id = BenchMsg::Ping;
+        return ping;
+    }
+
+    Fumbly::ClientInterface<BenchMsg> m_Waker;
+    Server& m_Server;
+    std::function<void()> m_FnWake;
+    std::atomic<bool> m_bRunning = true;
+    std::thread m_Thread;
+};
+
+static int RunThroughput(int argc, char** argv)
+{
+    const uint64_t nMessages = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    const size_t nBodySize = argc > 2 ? std::stoul(argv[2]) : 32;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60001;
+    const int nRoundTrips = 10000;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    BenchServer server(port);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    Fumbly::ClientInterface<BenchMsg> client;
+    if(!client.Connect("127.0.0.1", port))
+        return 1;
+
+    // Wait for the handshake
+    Fumbly::Message<BenchMsg> ping;
+    ping.Header.Id = BenchMsg::Ping;
+    client.Send(ping);
+    WaitForReply(client);
+
+    // Round trip latency, one message in flight
+    auto tStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < nRoundTrips; i++)
+    {
+        client.Send(ping);
+        WaitForReply(client);
+    }
+    double rtt = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nRoundTrips;
+
+    // One way throughput, the client keeps a bounded number of messages queued
+    Fumbly::Message<BenchMsg> data;
+    data.Header.Id = BenchMsg::Data;
+    data.Body.resize(nBodySize);
+    data.Header.Size = static_cast<uint32_t>(nBodySize);
+
+    tStart = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < nMessages; i++)
+    {
+        while(client.OutgoingCount() > 4096)
+            std::this_thread::yield();
+        client.Send(data);
+    }
+
+    Fumbly::Message<BenchMsg> done;
+    done.Header.Id = BenchMsg::Done;
+    client.Send(done);
+    WaitForReply(client);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    printf("backend %s: %llu messages of %zu bytes in %.3fs, %.0f msg/s, %.1f MB/s, rtt %.1fus\n", BackendName(),
+        (unsigned long long)server.nReceived.load(), nBodySize, seconds, nMessages / seconds,
+        nMessages * (nBodySize + sizeof(Fumbly::MessageHeader<BenchMsg>)) / seconds / 1e6, rtt);
+    fflush(stdout);
+    return 0;
+}
+
+// Same one way throughput as above, sent through pools of increasing size to a server with one io thread per core
+static int RunPool(int argc, char** argv)
+{
+    const uint64_t nMessages = argc > 2 ? std::stoull(argv[2]) : 1000000;
+    const size_t nBodySize = argc > 3 ? std::stoul(argv[3]) : 32;
+    const uint16_t port = argc > 4 ? static_cast<uint16_t>(std::stoi(argv[4])) : 60003;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    Fumbly::ServerSettings settings;
+    settings.nIOThreads = std::max(1u, std::thread::hardware_concurrency());
+    settings.bReusePort = true;
+    BenchServer server(port, settings);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    Fumbly::Message<BenchMsg> ping;
+    ping.Header.Id = BenchMsg::Ping;
+    Fumbly::Message<BenchMsg> data;
+    data.Header.Id = BenchMsg::Data;
+    data.Body.resize(nBodySize);
+    data.Header.Size = static_cast<uint32_t>(nBodySize);
+
+    for(uint32_t nConnections : {1, 2, 4, 8})
+    {
+        Fumbly::ClientPoolSettings poolSettings;
+        poolSettings.nConnections = nConnections;
+        Fumbly::ClientPool<BenchMsg> pool(poolSettings);
+        if(!pool.Connect("127.0.0.1", port))
+            return 1;
+
+        // One round trip per connection so every handshake is done before timing starts
+        for(uint32_t i = 0; i < nConnections; i++)
+            pool.Send(ping, i);
+        for(uint32_t i = 0; i < nConnections; i++)
+        {
+            while(!pool.WaitForMessages(std::chrono::milliseconds(100))) {}
+            pool.Incoming().PopFront();
+        }
+
+        // Each connection keeps a bounded number of messages queued, the total is only checked every few sends
+        server.nReceived = 0;
+        auto tStart = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < nMessages; i++)
+        {
+            if(i % 256 == 0)
+            {
+                while(pool.OutgoingCount() > 4096 * nConnections)
+                    std::this_thread::yield();
+            }
+            pool.Send(data);
+        }
+        while(server.nReceived < nMessages)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+        printf("backend %s, pool of %u: %llu messages of %zu bytes in %.3fs, %.0f msg/s, %.1f MB/s\n", BackendName(), nConnections,
+            (unsigned long long)nMessages, nBodySize, seconds, nMessages / seconds,
+            nMessages * (nBodySize + sizeof(Fumbly::MessageHeader<BenchMsg>)) / seconds / 1e6);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Calls are pipelined, the oldest call is waited for once depth calls are in flight. Latency is measured from
+// Call until its future is ready, so at depth > 1 it includes waiting behind the calls ahead of it
+static int RunRpc(int argc, char** argv)
+{
+    const uint32_t nCalls = argc > 2 ? std::stoul(argv[2]) : 20000;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60004;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    BenchServer server(port);
+    server.RegisterHandler(BenchMsg::Request, [](std::shared_ptr<Fumbly::Connection<BenchMsg>> client, Fumbly::Message<BenchMsg>& msg) {
+        return msg;
+    });
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    Fumbly::ClientInterface<BenchMsg> client;
+    if(!client.Connect("127.0.0.1", port))
+        return 1;
+
+    // Wait for the handshake
+    Fumbly::Message<BenchMsg> ping;
+    ping.Header.Id = BenchMsg::Ping;
+    client.Send(ping);
+    WaitForReply(client);
+
+    Fumbly::Message<BenchMsg> request;
+    request.Header.Id = BenchMsg::Request;
+    request << uint64_t(0);
+
+    using Clock = std::chrono::steady_clock;
+    for(uint32_t nDepth : {1, 16, 256})
+    {
+        std::deque<std::pair<std::future<Fumbly::Message<BenchMsg>>, Clock::time_point>> inFlight;
+        std::vector<double> latency;
+        latency.reserve(nCalls);
+
+        auto complete = [&]() {
+            inFlight.front().first.get();
+            latency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - inFlight.front().second).count());
+            inFlight.pop_front();
+        };
+
+        auto tStart = Clock::now();
+        for(uint32_t i = 0; i < nCalls; i++)
+        {
+            if(inFlight.size() == nDepth)
+                complete();
+            inFlight.emplace_back(client.Call(request), Clock::now());
+        }
+        while(!inFlight.empty())
+            complete();
+        double seconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+        printf("backend %s, rpc depth %u: %u calls in %.3fs, %.0f calls/s, latency p50 %.1fus p99 %.1fus\n", BackendName(), nDepth,
+            nCalls, seconds, nCalls / seconds, Percentile(latency, 0.5), Percentile(latency, 0.99));
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Same measurement as RunThroughput for a client already connected to server, over any stream protocol
+template<typename Protocol>
+static void MeasureTransport(const char* name, BenchServerOf<Protocol>& server, Fumbly::ClientInterface<BenchMsg, Protocol>& client,
+    uint64_t nMessages, size_t nBodySize)
+{
+    const int nRoundTrips = 10000;
+
+    auto waitForReply = [&client]() {
+        while(!client.WaitForMessages(std::chrono::milliseconds(100))) {}
+        client.Incoming().PopFront();
+    };
+
+    Fumbly::Message<BenchMsg> ping;
+    ping.Header.Id = BenchMsg::Ping;
+    BenchServerRunner runner(server, [&]() { client.Send(ping); });
+
+    client.Send(ping);
+    waitForReply();
+
+    auto tStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < nRoundTrips; i++)
+    {
+        client.Send(ping);
+        waitForReply();
+    }
+    double rtt = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nRoundTrips;
+
+    Fumbly::Message<BenchMsg> data;
+    data.Header.Id = BenchMsg::Data;
+    data.Body.resize(nBodySize);
+    data.Header.Size = static_cast<uint32_t>(nBodySize);
+
+    tStart = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < nMessages; i++)
+    {
+        while(client.OutgoingCount() > 4096)
+            std::this_thread::yield();
+        client.Send(data);
+    }
+
+    Fumbly::Message<BenchMsg> done;
+    done.Header.Id = BenchMsg::Done;
+    client.Send(done);
+    waitForReply();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    printf("backend %s, %s: %llu messages of %zu bytes in %.3fs, %.0f msg/s, %.1f MB/s, rtt %.1fus\n", BackendName(), name,
+        (unsigned long long)server.nReceived.load(), nBodySize, seconds, nMessages / seconds,
+        nMessages * (nBodySize + sizeof(Fumbly::MessageHeader<BenchMsg>)) / seconds / 1e6, rtt);
+    fflush(stdout);
+}
+
+// All of them run the same connection code, they only differ in the socket underneath
+static int RunTransports(int argc, char** argv)
+{
+    const uint64_t nMessages = argc > 2 ? std::stoull(argv[2]) : 1000000;
+    const size_t nBodySize = argc > 3 ? std::stoul(argv[3]) : 32;
+    const uint16_t port = 60008;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    {
+        BenchServer server(port);
+        server.Start();
+        Fumbly::ClientInterface<BenchMsg> client;
+        if(!client.Connect("127.0.0.1", port))
+            return 1;
+        MeasureTransport("tcp loopback", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+    }
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+    using Local = asio::local::stream_protocol;
+    {
+        const char* path = "/tmp/fumbly_bench.sock";
+        std::remove(path);
+        BenchServerOf<Local> server{Local::endpoint(path)};
+        server.Start();
+        Fumbly::ClientInterface<BenchMsg, Local> client;
+        if(!client.Connect(Local::endpoint(path)))
+            return 1;
+        MeasureTransport("unix socket", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+        std::remove(path);
+    }
+
+    {
+        BenchServerOf<Local> server{Fumbly::ServerSettings{}};
+        server.Start();
+        Fumbly::ClientInterface<BenchMsg, Local> client;
+        if(!server.ConnectSocketPair(client))
+            return 1;
+        MeasureTransport("socket pair", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+    }
+#endif
+
+    {
+        BenchServerOf<Fumbly::InProcessProtocol> server{Fumbly::ServerSettings{}};
+        server.Start();
+        Fumbly::ClientInterface<BenchMsg, Fumbly::InProcessProtocol> client;
+        if(!server.ConnectSocketPair(client))
+            return 1;
+        MeasureTransport("in process", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+    }
+    return 0;
+}
+
+// Round trip of a message stamped when it is sent, measured when the application gets to the echo
+static Fumbly::Message<BenchMsg> StampedPing()
+{
+    Fumbly::Message<BenchMsg> ping;
+    ping.Header.Id = BenchMsg::Ping;
+    ping << uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+    return ping;
+}
+
+static double StampedLatency(Fumbly::Message<BenchMsg>& msg)
+{
+    uint64_t nSent = 0;
+    msg >> nSent;
+    auto elapsed = std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(nSent));
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+// Each round sends a burst of pings and the next round starts once the whole burst is back. Wait + drain runs the
+// rounds on the main thread, callback delivery starts the next round from the handler on the io thread
+static int RunDelivery(int argc, char** argv)
+{
+    const uint32_t nMessages = argc > 2 ? std::stoul(argv[2]) : 20000;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60005;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    BenchServer server(port);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    std::vector<double> latency;
+    latency.reserve(nMessages);
+
+    Fumbly::ClientInterface<BenchMsg> waiting;
+    if(!waiting.Connect("127.0.0.1", port))
+        return 1;
+
+    auto waitRounds = [&](uint32_t nBurst, uint32_t nRounds) {
+        for(uint32_t r = 0; r < nRounds; r++)
+        {
+            for(uint32_t i = 0; i < nBurst; i++)
+                waiting.Send(StampedPing());
+
+            uint32_t nBack = 0;
+            while(nBack < nBurst)
+            {
+                waiting.WaitForMessages(std::chrono::milliseconds(100));
+                nBack += static_cast<uint32_t>(waiting.DrainIncoming([&](Fumbly::OwnedMessage<BenchMsg>& owned) {
+                    latency.push_back(StampedLatency(owned.Msg));
+                }));
+            }
+        }
+    };
+
+    // Only touched by the handler once a round is started, the round's sends order it after the setup here
+    Fumbly::ClientInterface<BenchMsg> callback;
+    uint32_t nBurst = 0, nBack = 0, nRoundsLeft = 0;
+    std::promise<void> roundsDone;
+    callback.SetMessageHandler([&](Fumbly::OwnedMessage<BenchMsg>& owned) {
+        latency.push_back(StampedLatency(owned.Msg));
+        if(++nBack < nBurst)
+            return;
+
+        nBack = 0;
+        if(--nRoundsLeft == 0)
+        {
+            roundsDone.set_value();
+            return;
+        }
+        for(uint32_t i = 0; i < nBurst; i++)
+            callback.Send(StampedPing());
+    });
+    if(!callback.Connect("127.0.0.1", port))
+        return 1;
+
+    auto callbackRounds = [&](uint32_t nBurstSize, uint32_t nRounds) {
+        roundsDone = std::promise<void>();
+        auto done = roundsDone.get_future();
+        nBurst = nBurstSize;
+        nRoundsLeft = nRounds;
+        for(uint32_t i = 0; i < nBurst; i++)
+            callback.Send(StampedPing());
+        done.wait();
+    };
+
+    // Handshakes
+    waitRounds(1, 1);
+    callbackRounds(1, 1);
+
+    for(uint32_t nBurstSize : {1, 64})
+    {
+        const uint32_t nRounds = std::max(1u, nMessages / nBurstSize);
+
+        // Cpu time of the whole process, server threads included, they do the same work in both modes
+        auto measure = [&](const char* name, auto&& rounds) {
+            latency.clear();
+            double cpuStart = ProcessCpuSeconds();
+            auto tStart = std::chrono::steady_clock::now();
+            rounds(nBurstSize, nRounds);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+            double cpu = ProcessCpuSeconds() - cpuStart;
+            printf("backend %s, %s, burst %u: latency p50 %.1fus p99 %.1fus, cpu %.1fus per message, %.0f%% of a core\n", BackendName(),
+                name, nBurstSize, Percentile(latency, 0.5), Percentile(latency, 0.99), cpu * 1e6 / latency.size(), 100.0 * cpu / seconds);
+        };
+        measure("wait + drain", waitRounds);
+        measure("callback", callbackRounds);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Timers of that many connections in one wheel driven by hand: each connection has an idle timeout, rearmed on every
+// read, and a heartbeat, rearmed when it fires. Idle timeouts never expire, heartbeats fire every 100 ticks
+static int RunTimers(int argc, char** argv)
+{
+    const uint32_t nConnections = argc > 2 ? std::stoul(argv[2]) : 100000;
+    const int nRearms = 10;
+    const uint64_t nTicks = 1000;
+
+    asio::io_context context;
+    Fumbly::TimerWheel wheel(context, std::chrono::milliseconds(100));
+
+    struct Timers
+    {
+        Fumbly::TimerNode Timeout;
+        Fumbly::TimerNode Heartbeat;
+    };
+    std::vector<Timers> timers(nConnections);
+    uint64_t nFired = 0;
+    for(auto& t : timers)
+    {
+        Timers* pTimers = &t;
+        t.Timeout.Callback = [pTimers]() {};
+        t.Heartbeat.Callback = [&wheel, &nFired, pTimers]() {
+            nFired++;
+            wheel.Schedule(pTimers->Heartbeat, std::chrono::milliseconds(10000));
+        };
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto tStart = Clock::now();
+    for(uint32_t i = 0; i < nConnections; i++)
+    {
+        wheel.Schedule(timers[i].Timeout, std::chrono::milliseconds(30000));
+        wheel.Schedule(timers[i].Heartbeat, std::chrono::milliseconds(100 * (1 + i % 100)));
+    }
+    double nsSchedule = std::chrono::duration<double, std::nano>(Clock::now() - tStart).count() / (2.0 * nConnections);
+
+    tStart = Clock::now();
+    for(int r = 0; r < nRearms; r++)
+    {
+        for(auto& t : timers)
+            wheel.Schedule(t.Timeout, std::chrono::milliseconds(30000));
+    }
+    double nsRearm = std::chrono::duration<double, std::nano>(Clock::now() - tStart).count() / (double(nRearms) * nConnections);
+
+    tStart = Clock::now();
+    for(uint64_t i = 0; i < nTicks; i++)
+        wheel.Advance();
+    double seconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+    printf("timers: %u connections, schedule %.1f ns, rearm %.1f ns, advance %.1f us per tick, %.1f ns per fired timer (%llu fired)\n",
+        nConnections, nsSchedule, nsRearm, seconds * 1e6 / nTicks, nFired > 0 ? seconds * 1e9 / nFired : 0.0, (unsigned long long)nFired);
+    printf("timers: %zu bytes per connection (2 nodes, nothing allocated per wait), 2 asio::steady_timers would be %zu bytes\n",
+        sizeof(Timers), 2 * sizeof(asio::steady_timer));
+    fflush(stdout);
+    return 0;
+}
+
+// Keeps the last validated connection so the bench can flood it from the server side
+class LanesBenchServer : public BenchServer
+{
+public:
+    using BenchServer::BenchServer;
+
+    std::shared_ptr<Fumbly::Connection<BenchMsg>> GetClient()
+    {
+        std::scoped_lock lock(m_MuxClient);
+        return m_Client;
+    }
+
+    void OnClientValidated(std::shared_ptr<Fumbly::Connection<BenchMsg>> client) override
+    {
+        std::scoped_lock lock(m_MuxClient);
+        m_Client = client;
+    }
+
+private:
+    std::mutex m_MuxClient;
+    std::shared_ptr<Fumbly::Connection<BenchMsg>> m_Client;
+};
+
+// The server keeps about 4MB of 16KB Data messages queued to the client while the client pings once a millisecond.
+// Without priorities every message shares one FIFO lane and pongs wait behind the queued bulk data, with lanes
+// pongs go out on Realtime and bulk data on Bulk
+static int RunLanes(int argc, char** argv)
+{
+    const uint32_t nPings = argc > 2 ? std::stoul(argv[2]) : 2000;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60010;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    for(bool bLanes : {false, true})
+    {
+        const uint16_t serverPort = static_cast<uint16_t>(port + (bLanes ? 1 : 0));
+        LanesBenchServer server(serverPort);
+        if(bLanes)
+        {
+            server.SetPriority(BenchMsg::Ping, Fumbly::Priority::Realtime);
+            server.SetPriority(BenchMsg::Data, Fumbly::Priority::Bulk);
+        }
+        server.Start();
+        BenchServerRunner runner(server, serverPort);
+
+        std::mutex muxLatency;
+        std::vector<double> latency;
+        std::atomic<uint64_t> nBulkBytes = 0;
+        Fumbly::ClientInterface<BenchMsg> client;
+        client.SetMessageHandler([&](Fumbly::OwnedMessage<BenchMsg>& owned) {
+            if(owned.Msg.Header.Id == BenchMsg::Data)
+            {
+                nBulkBytes += owned.Msg.Body.size();
+                return;
+            }
+            double us = StampedLatency(owned.Msg);
+            std::scoped_lock lock(muxLatency);
+            latency.push_back(us);
+        });
+        if(!client.Connect("127.0.0.1", serverPort))
+            return 1;
+
+        while(!server.GetClient())
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::shared_ptr<Fumbly::Connection<BenchMsg>> connection = server.GetClient();
+
+        std::atomic<bool> bFlooding = true;
+        std::thread thrFlood([&]() {
+            Fumbly::Message<BenchMsg> data;
+            data.Header.Id = BenchMsg::Data;
+            data.Body.resize(16 << 10);
+            data.Header.Size = static_cast<uint32_t>(data.Body.size());
+            while(bFlooding)
+            {
+                if(connection->OutgoingCount() < 256)
+                    connection->Send(data);
+                else
+                    std::this_thread::yield();
+            }
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto tStart = std::chrono::steady_clock::now();
+        uint64_t nBulkStart = nBulkBytes;
+        for(uint32_t i = 0; i < nPings; i++)
+        {
+            client.Send(StampedPing());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+        bFlooding = false;
+        thrFlood.join();
+
+        {
+            std::scoped_lock lock(muxLatency);
+            printf("backend %s, %s: %zu of %u pongs, latency p50 %.0fus p99 %.0fus, bulk %.1f MB/s\n", BackendName(),
+                bLanes ? "priority lanes" : "single FIFO lane", latency.size(), nPings, Percentile(latency, 0.5), Percentile(latency, 0.99),
+                (nBulkBytes - nBulkStart) / seconds / 1e6);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+static double ResidentMB()
+{
+    long nPages = 0, nResident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if(file)
+    {
+        if(fscanf(file, "%ld %ld", &nPages, &nResident) != 2)
+            nResident = 0;
+        fclose(file);
+    }
+    return nResident * double(sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+// Child process side of the idle benchmark: raw sockets that validate, exchange one message and then stay silent
+class IdleClients
+{
+public:
+    // With bClose each socket is closed once its exchange is done, for connect storms larger than the descriptor limit
+    IdleClients(uint16_t port, size_t nBodySize, bool bClose = false)
+        :m_Endpoint(asio::ip::make_address("127.0.0.1"), port), m_nBodySize(nBodySize), m_bClose(bClose)
+    {
+    }
+
+    // Returns the number of connections that completed the exchange
+    uint32_t Run(uint32_t nConnections)
+    {
+        m_Clients.resize(nConnections);
+
+        // Limit connects in flight so the listen backlog never overflows
+        m_nNext = std::min<uint32_t>(nConnections, 512);
+        for(uint32_t i = 0; i < m_nNext; i++)
+            Start(m_Clients[i]);
+
+        m_Context.run();
+        return m_nDone;
+    }
+
+private:
+    struct Client
+    {
+        std::unique_ptr<asio::ip::tcp::socket> Socket;
+        uint64_t Handshake = 0;
+        Fumbly::MessageHeader<BenchMsg> Header;
+        std::vector<uint8_t> Body;
+    };
+
+    void Start(Client& client)
+    {
+        client.Socket = std::make_unique<asio::ip::tcp::socket>(m_Context);
+        client.Socket->async_connect(m_Endpoint, [this, &client](std::error_code ec) {
+            if(ec) return Finish(false);
+            asio::async_read(*client.Socket, asio::buffer(&client.Handshake, sizeof(uint64_t)), [this, &client](std::error_code ec, size_t) {
+                if(ec) return Finish(false);
+                client.Handshake ^= 0xDEABCFFA;
+                client.Header.Id = BenchMsg::Ping;
+                client.Header.Size = static_cast<uint32_t>(m_nBodySize);
+                client.Body.resize(m_nBodySize);
+
+                std::array<asio::const_buffer, 3> request{asio::buffer(&client.Handshake, sizeof(uint64_t)),
+                    asio::buffer(&client.Header, sizeof(client.Header)), asio::buffer(client.Body)};
+                asio::async_write(*client.Socket, request, [this, &client](std::error_code ec, size_t) {
+                    if(ec) return Finish(false);
+
+                    // Echo comes back with the same size
+                    std::array<asio::mutable_buffer, 2> reply{asio::buffer(&client.Header, sizeof(client.Header)), asio::buffer(client.Body)};
+                    asio::async_read(*client.Socket, reply, [this, &client](std::error_code ec, size_t) {
+                        client.Body = {};
+                        if(m_bClose)
+                            client.Socket.reset();
+                        Finish(!ec);
+                    });
+                });
+            });
+        });
+    }
+
+    void Finish(bool bDone)
+    {
+        if(bDone)
+            m_nDone++;
+        if(m_nNext < m_Clients.size())
+            Start(m_Clients[m_nNext++]);
+    }
+
+    asio::io_context m_Context;
+    asio::ip::tcp::endpoint m_Endpoint;
+    size_t m_nBodySize;
+    bool m_bClose;
+    std::vector<Client> m_Clients;
+    uint32_t m_nNext = 0;
+    uint32_t m_nDone = 0;
+};
+
+// Server RSS growth per connection once every connection has validated, exchanged a message and gone idle
+static int RunIdle(int argc, char** argv)
+{
+    const uint32_t nConnections = argc > 2 ? std::stoul(argv[2]) : 10000;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60002;
+    const size_t nBodySize = 4096;
+
+    // Server and client process each hold one descriptor per connection
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = std::max<rlim_t>(limit.rlim_cur, std::min<rlim_t>(limit.rlim_max, nConnections + 64));
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < nConnections + 64)
+    {
+        fprintf(stderr, "descriptor limit %llu is too low for %u connections\n", (unsigned long long)limit.rlim_cur, nConnections);
+        return 1;
+    }
+
+    // Fork before any thread exists, the child waits for the server to listen
+    int pipeGo[2], pipeDone[2];
+    if(pipe(pipeGo) != 0 || pipe(pipeDone) != 0)
+        return 1;
+
+    pid_t child = fork();
+    if(child == 0)
+    {
+        char go;
+        if(read(pipeGo[0], &go, 1) != 1)
+            _exit(1);
+
+        IdleClients clients(port, nBodySize);
+        uint32_t nDone = 0;
+        std::thread thrClients([&]() { nDone = clients.Run(nConnections); });
+        thrClients.detach();
+
+        // Report once all exchanges finished, then keep the sockets open until killed
+        while(true)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            static bool bReported = false;
+            if(!bReported && nDone > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                uint32_t n = nDone;
+                bReported = write(pipeDone[1], &n, sizeof(n)) == sizeof(n);
+            }
+        }
+    }
+
+    Fumbly::Logger::Get().SetOutput(fopen("/dev/null", "w"));
+
+    // Raw clients never send heartbeats
+    Fumbly::ServerSettings settings;
+    settings.Timeouts.Idle = std::chrono::milliseconds(0);
+    BenchServer server(port, settings);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    double before = ResidentMB();
+
+    auto tStart = std::chrono::steady_clock::now();
+    uint32_t nDone = 0;
+    if(write(pipeGo[1], "g", 1) != 1 || read(pipeDone[0], &nDone, sizeof(nDone)) != sizeof(nDone))
+        nDone = 0;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    // Let the io thread settle (queued writes completed, buffers released)
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    double after = ResidentMB();
+
+    printf("idle: %u of %u connections in %.1fs, server rss %.1f MB -> %.1f MB, %.0f bytes per connection\n", nDone, nConnections,
+        seconds, before, after, nDone > 0 ? (after - before) * (1 << 20) / nDone : 0.0);
+    fflush(stdout);
+
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    return 0;
+}
+
+// Same workload over a shared memory link and over tcp loopback on the same machine
+static int RunShm(int argc, char** argv)
+{
+    const uint64_t nMessages = argc > 2 ? std::stoull(argv[2]) : 1000000;
+    const size_t nBodySize = argc > 3 ? std::stoul(argv[3]) : 32;
+    const uint16_t port = 60009;
+
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    {
+        using Shm = Fumbly::SharedMemoryProtocol;
+        BenchServerOf<Shm> server{Fumbly::ServerSettings{}};
+        server.Start();
+        if(!server.AttachSocket([](asio::io_context& ctx) { return Shm::socket::Create(ctx, "bench-link"); }))
+            return 1;
+        Fumbly::ClientInterface<BenchMsg, Shm> client;
+        if(!client.Connect(Shm::socket::Open(client.GetContext(), "bench-link")))
+            return 1;
+        MeasureTransport("shared memory", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+    }
+
+    {
+        BenchServer server(port);
+        server.Start();
+        Fumbly::ClientInterface<BenchMsg> client;
+        if(!client.Connect("127.0.0.1", port))
+            return 1;
+        MeasureTransport("tcp loopback", server, client, nMessages, nBodySize);
+        client.Disconnect();
+        server.Stop();
+    }
+    return 0;
+}
+
+// Clients are split over the client threads, each with its own io context, and the server gets as many io threads
+static int RunStorm(int argc, char** argv)
+{
+    const uint32_t nClients = argc > 2 ? std::stoul(argv[2]) : 20000;
+    const uint32_t nThreads = argc > 3 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    const uint16_t port = argc > 4 ? static_cast<uint16_t>(std::stoi(argv[4])) : 60007;
+
+    Fumbly::Logger::Get().SetOutput(fopen("/dev/null", "w"));
+
+    Fumbly::ServerSettings settings;
+    settings.nIOThreads = nThreads;
+    settings.bReusePort = true;
+    settings.Timeouts.Idle = std::chrono::milliseconds(0);
+    BenchServer server(port, settings);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    std::atomic<uint32_t> nDone = 0;
+    std::vector<std::thread> clientThreads;
+    auto tStart = std::chrono::steady_clock::now();
+    for(uint32_t t = 0; t < nThreads; t++)
+    {
+        uint32_t nShare = nClients / nThreads + (t < nClients % nThreads ? 1 : 0);
+        clientThreads.emplace_back([&, nShare]() {
+            IdleClients clients(port, 32, true);
+            nDone += clients.Run(nShare);
+        });
+    }
+    for(auto& thread : clientThreads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    printf("backend %s, storm of %u clients on %u threads: %u completed in %.2fs, %.0f accepted/s, %.0f validated/s\n", BackendName(),
+        nClients, nThreads, nDone.load(), seconds, server.nAccepted / seconds, server.nValidated / seconds);
+    fflush(stdout);
+    return 0;
+}
+
+// Log lines are written to /dev/null so only the cost to the calling thread and the writer's cpu time are measured.
+// The baseline is the old synchronous path: the same lines through std::cout, and the logger writing on the caller
+static int RunLog(int argc, char** argv)
+{
+    const uint32_t nConnections = argc > 2 ? std::stoul(argv[2]) : 10000;
+    const uint16_t port = argc > 3 ? static_cast<uint16_t>(std::stoi(argv[3])) : 60006;
+    const int nBursts = 200;
+    const int nBurstSize = 1024;
+
+    Fumbly::Logger::Get().SetOutput(fopen("/dev/null", "w"));
+
+    // The lines a server logs per connection, in bursts the ring can hold
+    asio::ip::tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), 51234);
+    std::error_code ec = std::make_error_code(std::errc::connection_reset);
+    uint32_t nID = 10000;
+    auto nsPerLine = [&](auto&& logLines) {
+        std::chrono::steady_clock::duration elapsed{};
+        for(int b = 0; b < nBursts; b++)
+        {
+            auto tStart = std::chrono::steady_clock::now();
+            for(int i = 0; i < nBurstSize / 4; i++)
+                logLines();
+            elapsed += std::chrono::steady_clock::now() - tStart;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (nBursts * nBurstSize);
+    };
+
+    uint64_t nDroppedBefore = Fumbly::Logger::Get().DroppedCount();
+    double nsLogger = nsPerLine([&]() {
+        FUMBLY_LOG_INFO("[SERVER] New Connection: ", endpoint);
+        FUMBLY_LOG_INFO("[SERVER] client: ", nID, " Connection Approved");
+        FUMBLY_LOG_INFO("[", nID, "] Client Validated");
+        FUMBLY_LOG_WARN("[SERVER] New Connection Error: ", ec);
+    });
+    uint64_t nDropped = Fumbly::Logger::Get().DroppedCount() - nDroppedBefore;
+
+    // stdout goes to /dev/null while the old lines run, std::cout writes through it
+    fflush(stdout);
+    int nStdout = dup(STDOUT_FILENO);
+    int nNull = open("/dev/null", O_WRONLY);
+    dup2(nNull, STDOUT_FILENO);
+    double nsCout = nsPerLine([&]() {
+        std::cout << "[SERVER] New Connection: " << endpoint << "\n";
+        std::cout << "[SERVER] client: " << nID << " Connection Approved\n";
+        std::cout << "[" << nID << "] Client Validated\n";
+        std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+    });
+    std::cout.flush();
+    fflush(stdout);
+    dup2(nStdout, STDOUT_FILENO);
+    close(nNull);
+    close(nStdout);
+
+    printf("log: %.0f ns per line on the calling thread (%llu dropped), std::cout baseline %.0f ns per line\n", nsLogger,
+        (unsigned long long)nDropped, nsCout);
+    fflush(stdout);
+
+    // Each connection logs on accept, approval, validation and disconnect
+    Fumbly::ServerSettings settings;
+    settings.Timeouts.Idle = std::chrono::milliseconds(0);
+    BenchServer server(port, settings);
+    server.Start();
+    BenchServerRunner runner(server, port);
+
+    for(bool bSynchronous : {false, true})
+    {
+        Fumbly::Logger::Get().SetSynchronous(bSynchronous);
+        IdleClients clients(port, 32, true);
+        auto tStart = std::chrono::steady_clock::now();
+        uint32_t nDone = clients.Run(nConnections);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+        printf("log: connect storm, %s, %u of %u connections in %.2fs, %.0f connections/s\n", bSynchronous ? "synchronous baseline" : "async",
+            nDone, nConnections, seconds, nDone / seconds);
+        fflush(stdout);
+    }
+    Fumbly::Logger::Get().SetSynchronous(false);
+    return 0;
+}
+
+// Cluster node of the broadcast benchmark. A Broadcast from a client goes to every client of the cluster tagged with
+// the sender's id, a Report is routed back to the client id at the end of its body
+class ClusterBenchServer : public Fumbly::ClusterServer<BenchMsg>
+{
+public:
+    using Fumbly::ClusterServer<BenchMsg>::ClusterServer;
+
+protected:
+    bool OnClientConnect(std::shared_ptr<Fumbly::Connection<BenchMsg>> client) override
+    {
+        return true;
+    }
+
+    void OnMessage(std::shared_ptr<Fumbly::Connection<BenchMsg>> client, Fumbly::Message<BenchMsg> msg) override
+    {
+        uint32_t target = 0;
+        switch(msg.Header.Id)
+        {
+            case BenchMsg::Ping:
+                client->Send(msg);
+                break;
+            case BenchMsg::Broadcast:
+                msg << client->GetID();
+                MessageAllClusterClients(msg);
+                break;
+            case BenchMsg::Report:
+                msg >> target;
+                MessageClusterClient(target, msg);
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+static int64_t MonotonicNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs node nNode of an nNodes cluster with clients on port + node and the bus on port + 100 + node
+static std::unique_ptr<ClusterBenchServer> StartClusterNode(uint32_t nNode, uint32_t nNodes, uint16_t port)
+{
+    Fumbly::ClusterSettings cluster;
+    cluster.NodeID = nNode;
+    cluster.BusPort = static_cast<uint16_t>(port + 100 + nNode);
+    cluster.RetryInterval = std::chrono::milliseconds(100);
+    for(uint32_t i = 0; i < nNodes; i++)
+    {
+        if(i != nNode)
+            cluster.Peers.push_back({i, "127.0.0.1", static_cast<uint16_t>(port + 100 + i)});
+    }
+
+    auto server = std::make_unique<ClusterBenchServer>(static_cast<uint16_t>(port + nNode), cluster);
+    server->Start();
+    return server;
+}
+
+// Answers every broadcast with a report of its one way latency to the client that sent it
+static void RunClusterListener(Fumbly::ClientInterface<BenchMsg>& client, uint32_t nNode, const std::atomic<bool>& bRunning)
+{
+    while(bRunning)
+    {
+        if(!client.WaitForMessages(std::chrono::milliseconds(100)))
+            continue;
+
+        client.DrainIncoming([&](Fumbly::OwnedMessage<BenchMsg>& owned) {
+            Fumbly::Message<BenchMsg>& msg = owned.Msg;
+            if(msg.Header.Id != BenchMsg::Broadcast)
+                return;
+
+            uint32_t origin = 0, seq = 0;
+            int64_t stamp = 0;
+            msg >> origin >> stamp >> seq;
+
+            Fumbly::Message<BenchMsg> report;
+            report.Header.Id = BenchMsg::Report;
+            report << seq << (MonotonicNanoseconds() - stamp) << nNode << origin;
+            client.Send(report);
+        });
+    }
+}
+
+// One process per node, each with a listening client. The client on node 0 broadcasts one message at a time and
+// waits for the report of every node, steady_clock is the same monotonic clock in every process
+static int RunCluster(int argc, char** argv)
+{
+    const uint32_t nNodes = argc > 2 ? std::stoul(argv[2]) : 4;
+    const uint32_t nBroadcasts = argc > 3 ? std::stoul(argv[3]) : 2000;
+    const uint16_t port = argc > 4 ? static_cast<uint16_t>(std::stoi(argv[4])) : 60010;
+
+    Fumbly::Logger::Get().SetOutput(fopen("/dev/null", "w"));
+
+    // Fork before any thread exists
+    std::vector<pid_t> children;
+    for(uint32_t nNode = 1; nNode < nNodes; nNode++)
+    {
+        pid_t child = fork();
+        if(child == 0)
+        {
+            auto server = StartClusterNode(nNode, nNodes, port);
+            BenchServerRunner runner(*server, static_cast<uint16_t>(port + nNode));
+
+            Fumbly::ClientInterface<BenchMsg> listener;
+            std::atomic<bool> bRunning = true;
+            if(listener.Connect("127.0.0.1", static_cast<uint16_t>(port + nNode)))
+                RunClusterListener(listener, nNode, bRunning);
+            _exit(0);
+        }
+        children.push_back(child);
+    }
+
+    auto server = StartClusterNode(0, nNodes, port);
+    BenchServerRunner runner(*server, port);
+
+    Fumbly::ClientInterface<BenchMsg> listener;
+    listener.Connect("127.0.0.1", port);
+    std::atomic<bool> bListening = true;
+    std::thread thrListener([&]() { RunClusterListener(listener, 0, bListening); });
+
+    Fumbly::ClientInterface<BenchMsg> client;
+    client.Connect("127.0.0.1", port);
+
+    // Sends broadcast seq and collects the latency reported by each node, false if a node did not report in time
+    std::vector<double> nodeLatency(nNodes);
+    auto broadcast = [&](uint32_t seq, std::chrono::milliseconds timeout) {
+        Fumbly::Message<BenchMsg> msg;
+        msg.Header.Id = BenchMsg::Broadcast;
+        msg << seq << MonotonicNanoseconds();
+        client.Send(msg);
+
+        uint32_t nReports = 0;
+        auto tEnd = std::chrono::steady_clock::now() + timeout;
+        while(nReports < nNodes && std::chrono::steady_clock::now() < tEnd)
+        {
+            if(!client.WaitForMessages(std::chrono::milliseconds(10)))
+                continue;
+
+            client.DrainIncoming([&](Fumbly::OwnedMessage<BenchMsg>& owned) {
+                Fumbly::Message<BenchMsg>& report = owned.Msg;
+                if(report.Header.Id != BenchMsg::Report)
+                    return;
+
+                uint32_t nNode = 0, reportSeq = 0;
+                int64_t latency = 0;
+                report >> nNode >> latency >> reportSeq;
+                if(reportSeq == seq && nNode < nNodes)
+                {
+                    nodeLatency[nNode] = latency / 1e3;
+                    nReports++;
+                }
+            });
+        }
+        return nReports == nNodes;
+    };
+
+    // Links and directory are up once a broadcast reaches every node and every report finds its way back
+    uint32_t seq = 1;
+    auto tWarmupEnd = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while(!broadcast(seq++, std::chrono::milliseconds(300)))
+    {
+        if(std::chrono::steady_clock::now() > tWarmupEnd)
+        {
+            fprintf(stderr, "cluster of %u nodes did not come up\n", nNodes);
+            for(pid_t child : children)
+                kill(child, SIGKILL);
+            _exit(1);
+        }
+    }
+
+    std::vector<double> allNodes, local, remote;
+    uint32_t nLost = 0;
+    for(uint32_t i = 0; i < nBroadcasts; i++)
+    {
+        if(!broadcast(seq++, std::chrono::milliseconds(1000)))
+        {
+            nLost++;
+            continue;
+        }
+        allNodes.push_back(*std::max_element(nodeLatency.begin(), nodeLatency.end()));
+        local.push_back(nodeLatency[0]);
+        remote.insert(remote.end(), nodeLatency.begin() + 1, nodeLatency.end());
+    }
+
+    auto percentile = [](std::vector<double>& values, double p) {
+        if(values.empty())
+            return 0.0;
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, size_t(p * values.size()))];
+    };
+    printf("cluster of %u nodes, %zu broadcasts (%u lost): every node p50 %.0fus p99 %.0fus, local client p50 %.0fus, "
+        "remote clients p50 %.0fus p99 %.0fus\n", nNodes, allNodes.size(), nLost, percentile(allNodes, 0.5), percentile(allNodes, 0.99),
+        percentile(local, 0.5), percentile(remote, 0.5), percentile(remote, 0.99));
+    fflush(stdout);
+
+    for(pid_t child : children)
+    {
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+    }
+
+    bListening = false;
+    thrListener.join();
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    const std::string mode = argc > 1 ? argv[1] : "";
+    if(mode == "pool")
+        return RunPool(argc, argv);
+    if(mode == "rpc")
+        return RunRpc(argc, argv);
+    if(mode == "delivery")
+        return RunDelivery(argc, argv);
+    if(mode == "timers")
+        return RunTimers(argc, argv);
+    if(mode == "transports")
+        return RunTransports(argc, argv);
+    if(mode == "lanes")
+        return RunLanes(argc, argv);
+
+    if(mode == "idle" || mode == "shm" || mode == "storm" || mode == "log" || mode == "cluster")
+    {
+#if defined(__linux__)
+        if(mode == "idle")
+            return RunIdle(argc, argv);
+        if(mode == "shm")
+            return RunShm(argc, argv);
+        if(mode == "storm")
+            return RunStorm(argc, argv);
+        if(mode == "log")
+            return RunLog(argc, argv);
+        return RunCluster(argc, argv);
+#else
+        std::cerr << "Benchmark mode " << mode << " is only supported on Linux\n";
+        return 1;
+#endif
+    }
+    return RunThroughput(argc, argv);
+}
@@ -56,29 +56,33 @@ int main()
 			
 		if(client.IsConnected())
 		{
-			if(!client.Incoming().Empty())	
+			// Sleep until messages arrive instead of spinning, wakes regularly to poll the keyboard
+			if(client.WaitForMessages(std::chrono::milliseconds(10)))
 			{
-				auto msg = client.Incoming().PopFront().Msg;
-				switch(msg.Header.Id)
+				client.DrainIncoming([](Fumbly::OwnedMessage<CustomMsgTypes>& owned)
 				{
-					case (CustomMsgTypes::ServerAccept):
+					auto& msg = owned.Msg;
+					switch(msg.Header.Id)
 					{
-						std::cout << "Connected to Server!" << "\n";
-					} break;
-					case (CustomMsgTypes::PingServer):
-					{
-						std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-						std::chrono::system_clock::time_point timeThen;
-						msg >> timeThen;
-						std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n";
-					} break;
-					case (CustomMsgTypes::ServerMessage):
-					{
-						uint32_t clientID; 
-						msg >> clientID;
-						std::cout << "Hello From: " << clientID << "\n";
-					} break;
-				}
+						case (CustomMsgTypes::ServerAccept):
+						{
+							std::cout << "Connected to Server!" << "\n";
+						} break;
+						case (CustomMsgTypes::PingServer):
+						{
+							std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
+							std::chrono::system_clock::time_point timeThen;
+							msg >> timeThen;
+							std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n";
+						} break;
+						case (CustomMsgTypes::ServerMessage):
+						{
+							uint32_t clientID; 
+							msg >> clientID;
+							std::cout << "Hello From: " << clientID << "\n";
+						} break;
+					}
+				});
 			}
 		}
 		else
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+namespace Fumbly {
+    // Single threaded FIFO on a vector with a moving head. Unlike std::deque it allocates nothing until the first
+    // push, and Release hands the storage back once the queue is idle, so an idle owner holds no queue memory
+    template<typename T>
+    class CompactQueue
+    {
+    public:
+        bool Empty() const { return m_nHead == m_Items.size(); }
+        size_t Count() const { return m_Items.size() - m_nHead; }
+        size_t Capacity() const { return m_Items.capacity(); }
+
+        T& Front() { return m_Items[m_nHead]; }
+        T& Back() { return m_Items.back(); }
+
+        void PushBack(const T& item) { m_Items.push_back(item); }
+        void PushBack(T&& item) { m_Items.push_back(std::move(item)); }
+
+        void PopFront()
+        {
+            // Drop what the item owns now rather than when the slot is reused
+            m_Items[m_nHead++] = T{};
+
+            if(m_nHead == m_Items.size())
+            {
+                m_Items.clear();
+                m_nHead = 0;
+            }
+            else if(m_nHead >= 64 && m_nHead * 2 >= m_Items.size())
+            {
+                // Popped slots outnumber live items, move the live ones down so the vector stops growing
+                m_Items.erase(m_Items.begin(), m_Items.begin() + m_nHead);
+                m_nHead = 0;
+            }
+        }
+
+        // Free the storage of an empty queue, it is allocated again on the next push
+        void Release()
+        {
+            if(Empty())
+            {
+                std::vector<T>().swap(m_Items);
+                m_nHead = 0;
+            }
+        }
+
+    private:
+        std::vector<T> m_Items;
+        size_t m_nHead = 0;
+    };
+}
@@ -4,9 +4,18 @@
 #pragma once
 
 #include "NetCommon.h"
+#include "NetLog.h"
 #include "NetMessage.h"
+#include "NetTimerWheel.h"
+#include "NetStream.h"
 #include "NetConnection.h"
 #include "NetClient.h"
+#include "NetClientPool.h"
 #include "NetServer.h"
+#include "NetCluster.h"
+#include "NetSharedMemory.h"
+#include "NetInProcess.h"
+#include "NetCapture.h"
+#include "NetReplay.h"
 
 #endif
\ No newline at end of file
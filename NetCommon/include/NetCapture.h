@@ -0,0 +1,252 @@
+#pragma once
+
+#include "NetCommon.h"
+#include "NetMessage.h"
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FUMBLY_HAS_CAPTURE 1
+
+namespace Fumbly {
+    enum class CaptureDirection : uint8_t
+    {
+        In,
+        Out
+    };
+
+    // On disk layout: CaptureFileHeader followed by records, each record is a CaptureRecord followed by the raw
+    // MessageHeader<T> bytes and the body. Records are 8 byte aligned
+    struct CaptureFileHeader
+    {
+        char Magic[8] = {'F', 'U', 'M', 'B', 'L', 'C', 'A', 'P'};
+        uint32_t Version = 1;
+        uint32_t Reserved = 0;
+    };
+
+    struct CaptureRecord
+    {
+        // Nanoseconds since the capture was opened
+        uint64_t Timestamp;
+        uint32_t ConnectionID;
+        CaptureDirection Direction;
+        uint8_t Reserved[3];
+        uint32_t HeaderSize;
+        uint32_t BodySize;
+    };
+
+    // Append only capture of frames into a memory mapped file. Writers reserve space with a single atomic add and
+    // copy straight into the mapping, so several io threads can capture at once without a lock. The whole address
+    // range is mapped up front and the file grows underneath it in large steps, the mapping never moves.
+    // Growth allocates real blocks, if the disk is full capture stops and further frames are only counted as dropped
+    class CaptureLog
+    {
+    public:
+        static constexpr uint64_t GrowStep = uint64_t(64) << 20;
+
+        CaptureLog(const std::string& path, uint64_t nMaxBytes = uint64_t(4) << 30)
+            :m_MaxSize(nMaxBytes), m_Start(std::chrono::steady_clock::now())
+        {
+            m_FD = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+            if(m_FD < 0)
+                throw std::system_error(errno, std::generic_category(), "open " + path);
+
+            void* mapped = mmap(nullptr, m_MaxSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, m_FD, 0);
+            if(mapped == MAP_FAILED)
+            {
+                close(m_FD);
+                throw std::system_error(errno, std::generic_category(), "mmap " + path);
+            }
+            m_Data = static_cast<uint8_t*>(mapped);
+
+            if(!Grow(sizeof(CaptureFileHeader)))
+            {
+                munmap(m_Data, m_MaxSize);
+                close(m_FD);
+                throw std::system_error(errno, std::generic_category(), "allocate " + path);
+            }
+            new (m_Data) CaptureFileHeader();
+            m_Offset = sizeof(CaptureFileHeader);
+        }
+
+        ~CaptureLog()
+        {
+            // Trim the preallocated tail so the file ends at the last record, or before the first one that was dropped
+            munmap(m_Data, m_MaxSize);
+            if(ftruncate(m_FD, (off_t)std::min(m_Offset.load(), m_End)) != 0) {}
+            close(m_FD);
+        }
+
+        CaptureLog(const CaptureLog& other) = delete;
+        void operator=(const CaptureLog& other) = delete;
+
+    public:
+        // Runs on io threads, never throws. Frames that do not fit are dropped and counted
+        template<typename T>
+        void Append(CaptureDirection direction, uint32_t connectionID, const Message<T>& msg)
+        {
+            if(m_bDisabled.load(std::memory_order_relaxed))
+            {
+                m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            uint64_t nRecordSize = (sizeof(CaptureRecord) + sizeof(MessageHeader<T>) + msg.Body.size() + 7) & ~uint64_t(7);
+            uint64_t offset = m_Offset.fetch_add(nRecordSize);
+            if(offset + nRecordSize > m_MaxSize ||
+                (offset + nRecordSize > m_FileSize.load(std::memory_order_acquire) && !Grow(offset + nRecordSize)))
+            {
+                Drop(offset);
+                return;
+            }
+
+            CaptureRecord record{};
+            record.Timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+            record.ConnectionID = connectionID;
+            record.Direction = direction;
+            record.HeaderSize = sizeof(MessageHeader<T>);
+            record.BodySize = static_cast<uint32_t>(msg.Body.size());
+
+            uint8_t* dst = m_Data + offset;
+            memcpy(dst, &record, sizeof(CaptureRecord));
+            memcpy(dst + sizeof(CaptureRecord), &msg.Header, sizeof(MessageHeader<T>));
+            if(!msg.Body.empty())
+                memcpy(dst + sizeof(CaptureRecord) + sizeof(MessageHeader<T>), msg.Body.data(), msg.Body.size());
+        }
+
+        uint64_t DroppedCount() const
+        {
+            return m_Dropped.load(std::memory_order_relaxed);
+        }
+
+        bool IsDisabled() const
+        {
+            return m_bDisabled.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Allocates the blocks instead of only extending the file, a sparse file would fault (SIGBUS) on the first
+        // write to a page the full disk cannot back. Returns false and disables capture if that fails
+        bool Grow(uint64_t nRequired)
+        {
+            std::scoped_lock lock(m_MuxGrow);
+            uint64_t size = m_FileSize.load();
+            if(nRequired <= size)
+                return true;
+            if(m_bDisabled)
+                return false;
+
+            uint64_t newSize = std::min(m_MaxSize, ((nRequired + GrowStep - 1) / GrowStep) * GrowStep);
+#if defined(__APPLE__)
+            // No posix_fallocate, the file stays sparse
+            int err = ftruncate(m_FD, (off_t)newSize) == 0 ? 0 : errno;
+#else
+            int err = posix_fallocate(m_FD, (off_t)size, (off_t)(newSize - size));
+#endif
+            if(err != 0)
+            {
+                m_bDisabled = true;
+                errno = err;
+                FUMBLY_LOG_ERROR("[CAPTURE] Could not grow capture file to ", newSize, " bytes (", std::error_code(err, std::generic_category()), "), capture disabled");
+                return false;
+            }
+            m_FileSize.store(newSize, std::memory_order_release);
+            return true;
+        }
+
+        // Record at offset will not be written, the file is cut before it so readers never see the gap
+        void Drop(uint64_t offset)
+        {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            std::scoped_lock lock(m_MuxGrow);
+            m_End = std::min(m_End, offset);
+        }
+
+    private:
+        int m_FD = -1;
+        uint8_t* m_Data = nullptr;
+        uint64_t m_MaxSize = 0;
+        std::chrono::steady_clock::time_point m_Start;
+
+        std::atomic<uint64_t> m_Offset{0};
+        std::atomic<uint64_t> m_FileSize{0};
+        std::atomic<uint64_t> m_Dropped{0};
+        std::atomic<bool> m_bDisabled{false};
+
+        // Guards growth and m_End, the end of the last record before any dropped one
+        std::mutex m_MuxGrow;
+        uint64_t m_End = UINT64_MAX;
+    };
+
+    // Read only view of a capture file, Next() walks the records in file order (roughly time order per io thread)
+    class CaptureReader
+    {
+    public:
+        struct Frame
+        {
+            const CaptureRecord* Record = nullptr;
+            const uint8_t* Header = nullptr;
+            const uint8_t* Body = nullptr;
+        };
+
+        CaptureReader(const std::string& path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            struct stat st{};
+            if(fd < 0 || fstat(fd, &st) != 0)
+                throw std::system_error(errno, std::generic_category(), "open " + path);
+
+            m_Size = (size_t)st.st_size;
+            void* mapped = m_Size > 0 ? mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            close(fd);
+            if(mapped == MAP_FAILED || m_Size < sizeof(CaptureFileHeader)
+                || memcmp(static_cast<const CaptureFileHeader*>(mapped)->Magic, CaptureFileHeader().Magic, 8) != 0)
+            {
+                if(mapped != MAP_FAILED) munmap(mapped, m_Size);
+                throw std::runtime_error("not a capture file: " + path);
+            }
+            m_Data = static_cast<const uint8_t*>(mapped);
+            m_Offset = sizeof(CaptureFileHeader);
+        }
+
+        ~CaptureReader()
+        {
+            munmap(const_cast<uint8_t*>(m_Data), m_Size);
+        }
+
+        CaptureReader(const CaptureReader& other) = delete;
+        void operator=(const CaptureReader& other) = delete;
+
+        // Returns false at the end of the capture (a record that was reserved but never written also ends it)
+        bool Next(Frame& frame)
+        {
+            if(m_Offset + sizeof(CaptureRecord) > m_Size)
+                return false;
+
+            const CaptureRecord* record = reinterpret_cast<const CaptureRecord*>(m_Data + m_Offset);
+            uint64_t nRecordSize = (sizeof(CaptureRecord) + uint64_t(record->HeaderSize) + record->BodySize + 7) & ~uint64_t(7);
+            if(record->HeaderSize == 0 || m_Offset + nRecordSize > m_Size)
+                return false;
+
+            frame.Record = record;
+            frame.Header = m_Data + m_Offset + sizeof(CaptureRecord);
+            frame.Body = frame.Header + record->HeaderSize;
+            m_Offset += nRecordSize;
+            return true;
+        }
+
+        void Rewind()
+        {
+            m_Offset = sizeof(CaptureFileHeader);
+        }
+
+    private:
+        const uint8_t* m_Data = nullptr;
+        size_t m_Size = 0;
+        size_t m_Offset = 0;
+    };
+}
+#endif
@@ -9,11 +9,12 @@
 #include "NetConnection.h"
 
 namespace Fumbly {
-    template<typename T>
+    template<typename T, typename Protocol = asio::ip::tcp>
     class ClientInterface
     {
     public:
-        ClientInterface() : m_Socket(m_AsioContext)
+        ClientInterface(const TimeoutSettings& timeouts = {}, const FrameSettings& frames = {})
+            : m_Socket(m_AsioContext), m_TimerWheel(m_AsioContext), m_Timeouts(timeouts), m_Frames(frames)
         {
         }
 
@@ -22,6 +23,8 @@ namespace Fumbly {
             Disconnect();
         }
     public:
+        // TCP only - resolve hostname and connect
+        template<typename P = Protocol, typename = std::enable_if_t<std::is_same_v<P, asio::ip::tcp>>>
         bool Connect(const std::string& host, const uint16_t port)
         {
             try
@@ -30,26 +33,33 @@ namespace Fumbly {
                 asio::ip::tcp::resolver resolver(m_AsioContext);
                 asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
 
-                // Create Connection Instance and instantiate client socket
-                m_Connection = std::make_unique<Connection<T>>(
-                    Connection<T>::Owner::Client,
-                    m_AsioContext,
-                    asio::ip::tcp::socket(m_AsioContext),
-                    m_QMessagesIn
-                    );
-
-                // Tell the connection object to connect to server and prime it for listening to messages
-                m_Connection->ConnectToServer(endpoints);
-
-                // Start Context Thread
-                m_ThrContext = std::thread([this](){m_AsioContext.run();});
+                return StartConnection(typename Protocol::socket(m_AsioContext),
+                    [&endpoints](Connection<T, Protocol>& connection) { connection.ConnectToServer(endpoints); });
             }
             catch (const std::exception& e) {
-                std::cerr << "Client Exception: " << e.what() << "\n";
+                FUMBLY_LOG_ERROR("Client Exception: ", e.what());
                 return false;
             }
+        }
 
-            return true;
+        // Connect to a single endpoint of any protocol (i.e a unix domain socket path)
+        bool Connect(const typename Protocol::endpoint& endpoint)
+        {
+            std::array<typename Protocol::endpoint, 1> endpoints{endpoint};
+            return StartConnection(typename Protocol::socket(m_AsioContext),
+                [&endpoints](Connection<T, Protocol>& connection) { connection.ConnectToServer(endpoints); });
+        }
+
+        // Adopt a socket that is already connected to a server, it must have been created on GetContext()
+        bool Connect(typename Protocol::socket socket)
+        {
+            return StartConnection(std::move(socket),
+                [](Connection<T, Protocol>& connection) { connection.ConnectToServer(); });
+        }
+
+        asio::io_context& GetContext()
+        {
+            return m_AsioContext;
         }
 
         void Disconnect()
@@ -65,7 +75,17 @@ namespace Fumbly {
                 m_ThrContext.join();
             }
 
-            m_Connection.release();
+            // Asio thread is stopped, nothing can run on the connection anymore. Destroying it closes the socket,
+            // which the Close posted above may not have reached before the context stopped
+            m_Connection.reset();
+
+            // Any calls still waiting will never be answered
+            std::scoped_lock lock(m_MuxPendingCalls);
+            for(auto& [id, call] : m_PendingCalls)
+            {
+                call.Promise.set_exception(std::make_exception_ptr(std::runtime_error("RPC call aborted, client disconnected")));
+            }
+            m_PendingCalls.clear();
         }
 
         bool IsConnected()
@@ -78,17 +98,204 @@ namespace Fumbly {
             }
         }
 
-        TSQueue<OwnedMessage<T>>& Incoming()
+        TSQueue<OwnedMessage<T, Protocol>>& Incoming()
         {
             return m_QMessagesIn;
         }
 
+        // Blocks until a message is queued or timeout expires, returns true if messages are waiting
+        bool WaitForMessages(std::chrono::milliseconds timeout)
+        {
+            return m_QMessagesIn.WaitFor(timeout);
+        }
+
+        // Passes up to nMaxMessages queued messages to handler taking the queue lock once, returns number handled
+        template<typename Handler>
+        size_t DrainIncoming(Handler&& handler, size_t nMaxMessages = -1)
+        {
+            return m_QMessagesIn.Drain(std::forward<Handler>(handler), nMaxMessages);
+        }
+
+        // Callback delivery - messages bypass Incoming() and are handed to handler on the asio thread.
+        // Must be set before Connect
+        void SetMessageHandler(std::function<void(OwnedMessage<T, Protocol>&)> handler)
+        {
+            m_FnMessageHandler = std::move(handler);
+            m_MessageExecutor.reset();
+        }
+
+        // Callback delivery - same as above but handler is posted to a user executor (i.e a worker io_context or strand)
+        void SetMessageHandler(std::function<void(OwnedMessage<T, Protocol>&)> handler, asio::any_io_executor executor)
+        {
+            m_FnMessageHandler = std::move(handler);
+            m_MessageExecutor = std::move(executor);
+        }
+
+        // Streams from the server are handed over chunk by chunk on the asio thread (i.e into a StreamFileSink).
+        // Must be set before Connect
+        void SetStreamHandler(std::function<void(const StreamChunk<T>&)> handler)
+        {
+            m_FnStreamHandler = std::move(handler);
+        }
+
+        // Outbound lane for messages of type id, must be set before Connect
+        void SetPriority(T id, Priority priority)
+        {
+            m_Priorities[id] = priority;
+        }
+
         void Send(const Message<T>& msg)
         {
             if(IsConnected())
                 m_Connection->Send(msg);
         }
 
+        // Send on an explicit lane, i.e an input ack as Priority::Control
+        void Send(const Message<T>& msg, Priority priority)
+        {
+            if(IsConnected())
+                m_Connection->Send(msg, priority);
+        }
+
+        // Send a payload of any size in chunks interleaved with other messages, returns the stream id or 0
+        uint32_t SendStream(T id, std::vector<uint8_t> payload, Priority priority = Priority::Bulk)
+        {
+            return IsConnected() ? m_Connection->SendStream(id, std::move(payload), priority) : 0;
+        }
+
+        // Messages queued on the connection that are not fully written yet
+        size_t OutgoingCount()
+        {
+            return m_Connection ? m_Connection->OutgoingCount() : 0;
+        }
+
+        // RPC - Send request and return a future fulfilled by the response carrying the same correlation id.
+        // Any number of calls may be in flight at once, responses can arrive in any order
+        std::future<Message<T>> Call(Message<T> msg, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+        {
+            std::promise<Message<T>> promise;
+            std::future<Message<T>> future = promise.get_future();
+
+            if(!IsConnected())
+            {
+                promise.set_exception(std::make_exception_ptr(std::runtime_error("RPC call failed, client not connected")));
+                return future;
+            }
+
+            // Would never be sent, fail now instead of waiting out the timeout
+            if(msg.Body.size() > m_Frames.MaxFrameSize)
+            {
+                promise.set_exception(std::make_exception_ptr(std::runtime_error("RPC call failed, request exceeds max frame size")));
+                return future;
+            }
+
+            // 0 is reserved for messages that are not part of a call
+            uint32_t id = m_CorrelationCounter.fetch_add(1);
+            if(id == 0) id = m_CorrelationCounter.fetch_add(1);
+            msg.Header.CorrelationID = id;
+
+            {
+                std::scoped_lock lock(m_MuxPendingCalls);
+                PendingCall& call = m_PendingCalls[id];
+                call.Promise = std::move(promise);
+                call.Timer = std::make_unique<asio::steady_timer>(m_AsioContext, timeout);
+
+                // ASYNC - Fail the call if no response arrives in time
+                call.Timer->async_wait([this, id](std::error_code ec) {
+                    if(ec) return;
+
+                    std::scoped_lock lock(m_MuxPendingCalls);
+                    auto it = m_PendingCalls.find(id);
+                    if(it != m_PendingCalls.end())
+                    {
+                        it->second.Promise.set_exception(std::make_exception_ptr(std::runtime_error("RPC call timed out")));
+                        m_PendingCalls.erase(it);
+                    }
+                });
+            }
+
+            m_Connection->Send(msg);
+            return future;
+        }
+
+    private:
+        template<typename Starter>
+        bool StartConnection(typename Protocol::socket socket, Starter&& start)
+        {
+            try
+            {
+                // Create Connection Instance and instantiate client socket
+                m_Connection = std::make_unique<Connection<T, Protocol>>(
+                    Connection<T, Protocol>::Owner::Client,
+                    m_AsioContext,
+                    std::move(socket),
+                    m_QMessagesIn,
+                    &m_TimerWheel,
+                    m_Timeouts,
+                    m_Frames
+                    );
+
+                // Responses to outstanding calls are matched before reaching the incoming queue
+                m_Connection->SetIncomingHandler([this](Message<T>& msg) { return OnResponse(msg); });
+                m_Connection->SetStreamHandler(m_FnStreamHandler);
+                m_Connection->SetPriorities(&m_Priorities);
+
+                // Tell the connection object to connect to server and prime it for listening to messages
+                start(*m_Connection);
+
+                m_TimerWheel.Start();
+
+                // Start Context Thread
+                m_ThrContext = std::thread([this](){m_AsioContext.run();});
+            }
+            catch (const std::exception& e) {
+                FUMBLY_LOG_ERROR("Client Exception: ", e.what());
+                return false;
+            }
+
+            return true;
+        }
+
+        // Called on the asio thread for every incoming message, returns true if message answered a pending call
+        bool OnResponse(Message<T>& msg)
+        {
+            if(msg.Header.CorrelationID == 0)
+                return DeliverMessage(msg);
+
+            std::scoped_lock lock(m_MuxPendingCalls);
+            auto it = m_PendingCalls.find(msg.Header.CorrelationID);
+            if(it == m_PendingCalls.end())
+            {
+                // Late response to a call that already timed out
+                return true;
+            }
+
+            it->second.Timer->cancel();
+            it->second.Promise.set_value(msg);
+            m_PendingCalls.erase(it);
+            return true;
+        }
+
+        // Called on the asio thread, returns true if message was given to the user callback instead of the queue
+        bool DeliverMessage(Message<T>& msg)
+        {
+            if(!m_FnMessageHandler)
+                return false;
+
+            if(m_MessageExecutor)
+            {
+                asio::post(*m_MessageExecutor, [this, owned = OwnedMessage<T, Protocol>{nullptr, msg}]() mutable {
+                    m_FnMessageHandler(owned);
+                });
+            }
+            else
+            {
+                OwnedMessage<T, Protocol> owned{nullptr, std::move(msg)};
+                m_FnMessageHandler(owned);
+            }
+            return true;
+        }
+
     protected:
 
         // Asio context that handles the data transfer...
@@ -98,14 +305,39 @@ namespace Fumbly {
         std::thread m_ThrContext;
 
         // This is the hardware socket that is connected to the server
-        asio::ip::tcp::socket m_Socket;
+        typename Protocol::socket m_Socket;
+
+        // Drives the connection's handshake/idle/heartbeat timeouts on the context thread
+        TimerWheel m_TimerWheel;
+        TimeoutSettings m_Timeouts;
+        FrameSettings m_Frames;
 
         // Client has single instance of connection which handles data transfer
-        std::unique_ptr<Connection<T>> m_Connection;
+        std::unique_ptr<Connection<T, Protocol>> m_Connection;
 
     private:
         // Thread safe queue of incoming messages from server to be used by connection
-        TSQueue<OwnedMessage<T>> m_QMessagesIn;
+        TSQueue<OwnedMessage<T, Protocol>> m_QMessagesIn;
+
+        struct PendingCall
+        {
+            std::promise<Message<T>> Promise;
+            std::unique_ptr<asio::steady_timer> Timer;
+        };
+
+        // Calls waiting on a response keyed by correlation id
+        std::unordered_map<uint32_t, PendingCall> m_PendingCalls;
+        std::mutex m_MuxPendingCalls;
+        std::atomic<uint32_t> m_CorrelationCounter = 1;
+
+        // Optional callback delivery, runs on the asio thread unless an executor is given
+        std::function<void(OwnedMessage<T, Protocol>&)> m_FnMessageHandler;
+        std::optional<asio::any_io_executor> m_MessageExecutor;
+
+        std::function<void(const StreamChunk<T>&)> m_FnStreamHandler;
+
+        // Outbound lane by message type
+        std::unordered_map<T, Priority> m_Priorities;
     };
 }
 
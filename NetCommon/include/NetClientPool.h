@@ -0,0 +1,298 @@
+#pragma once
+
+#include "NetCommon.h"
+#include "NetMessage.h"
+#include "TSQueue.h"
+#include "NetClient.h"
+
+namespace Fumbly {
+    struct ClientPoolSettings
+    {
+        // Connections kept open, spread round robin over the endpoints. Each has its own socket and io thread
+        uint32_t nConnections = 4;
+
+        // A failed connection is replaced after this long, messages it had not written yet are lost
+        std::chrono::milliseconds RetryInterval{500};
+
+        TimeoutSettings Timeouts;
+        FrameSettings Frames;
+    };
+
+    // Pool of client connections to one or more servers, for backend services that need more than one stream
+    // and one io thread. Send goes to the least queued connection or to the connection picked by an affinity key,
+    // everything received on any connection lands in the single Incoming() queue
+    template<typename T, typename Protocol = asio::ip::tcp>
+    class ClientPool
+    {
+    public:
+        ClientPool(const ClientPoolSettings& settings = {})
+            :m_Settings(settings)
+        {
+            m_Settings.nConnections = std::max<uint32_t>(1, m_Settings.nConnections);
+        }
+
+        ~ClientPool()
+        {
+            Disconnect();
+        }
+
+        ClientPool(const ClientPool& other) = delete;
+        void operator=(const ClientPool& other) = delete;
+
+    public:
+        // TCP only - resolve hostname once and connect the whole pool to it
+        template<typename P = Protocol, typename = std::enable_if_t<std::is_same_v<P, asio::ip::tcp>>>
+        bool Connect(const std::string& host, const uint16_t port)
+        {
+            try
+            {
+                asio::io_context context;
+                asio::ip::tcp::resolver resolver(context);
+                auto results = resolver.resolve(host, std::to_string(port));
+                return Connect(std::vector<typename Protocol::endpoint>{results.begin()->endpoint()});
+            }
+            catch (const std::exception& e) {
+                FUMBLY_LOG_ERROR("Client Pool Exception: ", e.what());
+                return false;
+            }
+        }
+
+        // Connection i goes to endpoints[i % endpoints.size()], returns true if at least one connection started
+        bool Connect(const std::vector<typename Protocol::endpoint>& endpoints)
+        {
+            if(endpoints.empty() || m_ThrMaintain.joinable())
+                return false;
+
+            bool bAnyStarted = false;
+            {
+                std::scoped_lock lock(m_MuxMembers);
+                for(uint32_t i = 0; i < m_Settings.nConnections; i++)
+                {
+                    auto member = std::make_unique<Member>();
+                    member->Endpoint = endpoints[i % endpoints.size()];
+                    member->Client = StartClient(member->Endpoint);
+                    member->LastAttempt = std::chrono::steady_clock::now();
+                    bAnyStarted |= member->Client != nullptr;
+                    m_Members.push_back(std::move(member));
+                }
+            }
+
+            m_bRunning = true;
+            m_ThrMaintain = std::thread([this]() { Maintain(); });
+            return bAnyStarted;
+        }
+
+        void Disconnect()
+        {
+            if(m_ThrMaintain.joinable())
+            {
+                {
+                    std::scoped_lock lock(m_MuxMaintain);
+                    m_bRunning = false;
+                }
+                m_CvMaintain.notify_one();
+                m_ThrMaintain.join();
+            }
+
+            // Clients join their io threads as they are destroyed, which must not happen under the lock
+            std::vector<std::unique_ptr<Member>> members;
+            {
+                std::scoped_lock lock(m_MuxMembers);
+                members.swap(m_Members);
+            }
+        }
+
+        // Connections currently open (connecting and validating count as open)
+        size_t ConnectedCount()
+        {
+            std::scoped_lock lock(m_MuxMembers);
+            return std::count_if(m_Members.begin(), m_Members.end(), [](const std::unique_ptr<Member>& member) { return member->IsUp(); });
+        }
+
+        bool IsConnected()
+        {
+            return ConnectedCount() > 0;
+        }
+
+        TSQueue<OwnedMessage<T, Protocol>>& Incoming()
+        {
+            return m_QMessagesIn;
+        }
+
+        // Blocks until a message is queued or timeout expires, returns true if messages are waiting
+        bool WaitForMessages(std::chrono::milliseconds timeout)
+        {
+            return m_QMessagesIn.WaitFor(timeout);
+        }
+
+        // Passes up to nMaxMessages queued messages to handler taking the queue lock once, returns number handled
+        template<typename Handler>
+        size_t DrainIncoming(Handler&& handler, size_t nMaxMessages = -1)
+        {
+            return m_QMessagesIn.Drain(std::forward<Handler>(handler), nMaxMessages);
+        }
+
+        // Outbound lane for messages of type id on every connection, must be set before Connect
+        void SetPriority(T id, Priority priority)
+        {
+            m_Priorities[id] = priority;
+        }
+
+        // Sends on the open connection with the fewest messages waiting to be written, returns false if none is open
+        bool Send(const Message<T>& msg)
+        {
+            std::scoped_lock lock(m_MuxMembers);
+            Member* pMember = LeastQueued();
+            if(pMember)
+                pMember->Client->Send(msg);
+            return pMember != nullptr;
+        }
+
+        // Messages with the same key always take the same connection and so arrive in the order they were sent.
+        // While that connection is being replaced its keys move to the next open connection
+        bool Send(const Message<T>& msg, uint64_t affinityKey)
+        {
+            std::scoped_lock lock(m_MuxMembers);
+            Member* pMember = ByAffinity(affinityKey);
+            if(pMember)
+                pMember->Client->Send(msg);
+            return pMember != nullptr;
+        }
+
+        // RPC on the least queued connection, see ClientInterface::Call
+        std::future<Message<T>> Call(Message<T> msg, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+        {
+            std::scoped_lock lock(m_MuxMembers);
+            Member* pMember = LeastQueued();
+            if(pMember)
+                return pMember->Client->Call(std::move(msg), timeout);
+
+            std::promise<Message<T>> promise;
+            promise.set_exception(std::make_exception_ptr(std::runtime_error("RPC call failed, no pool connection open")));
+            return promise.get_future();
+        }
+
+        // Messages queued on all connections that are not fully written yet
+        size_t OutgoingCount()
+        {
+            std::scoped_lock lock(m_MuxMembers);
+            size_t nOutgoing = 0;
+            for(auto& member : m_Members)
+            {
+                if(member->Client)
+                    nOutgoing += member->Client->OutgoingCount();
+            }
+            return nOutgoing;
+        }
+
+    private:
+        struct Member
+        {
+            typename Protocol::endpoint Endpoint;
+            std::unique_ptr<ClientInterface<T, Protocol>> Client;
+            std::chrono::steady_clock::time_point LastAttempt{};
+
+            bool IsUp() const { return Client && Client->IsConnected(); }
+        };
+
+        // Every connection delivers straight into the pool's queue on its own io thread
+        std::unique_ptr<ClientInterface<T, Protocol>> StartClient(const typename Protocol::endpoint& endpoint)
+        {
+            auto client = std::make_unique<ClientInterface<T, Protocol>>(m_Settings.Timeouts, m_Settings.Frames);
+            client->SetMessageHandler([this](OwnedMessage<T, Protocol>& msg) { m_QMessagesIn.PushBack(std::move(msg)); });
+            for(auto& [id, priority] : m_Priorities)
+                client->SetPriority(id, priority);
+
+            if(!client->Connect(endpoint))
+                return nullptr;
+            return client;
+        }
+
+        // m_MuxMembers must be held
+        Member* LeastQueued()
+        {
+            Member* pBest = nullptr;
+            size_t nBest = 0;
+            for(auto& member : m_Members)
+            {
+                if(!member->IsUp())
+                    continue;
+
+                size_t nOutgoing = member->Client->OutgoingCount();
+                if(!pBest || nOutgoing < nBest)
+                {
+                    pBest = member.get();
+                    nBest = nOutgoing;
+                }
+            }
+            return pBest;
+        }
+
+        // m_MuxMembers must be held
+        Member* ByAffinity(uint64_t affinityKey)
+        {
+            for(size_t i = 0; i < m_Members.size(); i++)
+            {
+                Member* pMember = m_Members[(affinityKey + i) % m_Members.size()].get();
+                if(pMember->IsUp())
+                    return pMember;
+            }
+            return nullptr;
+        }
+
+        // Replaces failed connections in the background, the new client connects before it is swapped in so
+        // senders never wait on a connect
+        void Maintain()
+        {
+            std::unique_lock<std::mutex> ul(m_MuxMaintain);
+            while(m_bRunning)
+            {
+                m_CvMaintain.wait_for(ul, m_Settings.RetryInterval, [this]() { return !m_bRunning; });
+                if(!m_bRunning)
+                    break;
+
+                for(size_t i = 0; i < m_Settings.nConnections; i++)
+                {
+                    typename Protocol::endpoint endpoint;
+                    {
+                        std::scoped_lock lock(m_MuxMembers);
+                        Member& member = *m_Members[i];
+                        if(member.IsUp() || std::chrono::steady_clock::now() - member.LastAttempt < m_Settings.RetryInterval)
+                            continue;
+                        endpoint = member.Endpoint;
+                    }
+
+                    std::unique_ptr<ClientInterface<T, Protocol>> client = StartClient(endpoint);
+                    if(client)
+                        FUMBLY_LOG_INFO("[POOL] Replacing connection ", i);
+                    {
+                        std::scoped_lock lock(m_MuxMembers);
+                        Member& member = *m_Members[i];
+                        member.LastAttempt = std::chrono::steady_clock::now();
+                        member.Client.swap(client);
+                    }
+
+                    // Failed client is destroyed here, outside the lock
+                }
+            }
+        }
+
+    private:
+        ClientPoolSettings m_Settings;
+
+        // Merged incoming queue of all connections
+        TSQueue<OwnedMessage<T, Protocol>> m_QMessagesIn;
+
+        // Declared after the queue so connections still delivering into it are destroyed first
+        std::vector<std::unique_ptr<Member>> m_Members;
+        std::mutex m_MuxMembers;
+
+        std::thread m_ThrMaintain;
+        std::mutex m_MuxMaintain;
+        std::condition_variable m_CvMaintain;
+        bool m_bRunning = false;
+
+        // Outbound lane by message type, copied to every connection
+        std::unordered_map<T, Priority> m_Priorities;
+    };
+}
@@ -0,0 +1,581 @@
+#pragma once
+
+#include "NetCommon.h"
+#include "NetMessage.h"
+#include "NetClient.h"
+#include "NetServer.h"
+
+namespace Fumbly {
+    // Frames exchanged between cluster nodes over the bus, every frame ends with the sending node's id
+    enum class ClusterOp : uint32_t
+    {
+        // Sent first on every new link, the receiver forgets what it knew about the sender's clients
+        Hello,
+        // Body is a list of client ids now (or no longer) connected to the sender
+        ClientsJoined,
+        ClientsLeft,
+        // Body is a wrapped client message (see ClusterServer::Wrap) for all clients, a group or one client
+        Broadcast,
+        Group,
+        Direct
+    };
+
+    struct ClusterPeer
+    {
+        uint32_t NodeID = 0;
+        std::string Host;
+        uint16_t BusPort = 0;
+    };
+
+    struct ClusterSettings
+    {
+        // Unique per node and below 256, it becomes the top byte of every client id the node hands out so ids are
+        // unique across the cluster
+        uint32_t NodeID = 0;
+
+        // Port this node listens on for links from its peers
+        uint16_t BusPort = 0;
+
+        // Every other node of the cluster, each node links to each peer once
+        std::vector<ClusterPeer> Peers;
+
+        // Links that are down are retried this often, frames for a node whose link is down are dropped
+        std::chrono::milliseconds RetryInterval{500};
+    };
+
+    // Server that is one node of a cluster. Nodes link through a FumblyNet bus, broadcasts and group messages
+    // are forwarded once per node and fanned out to clients by the receiving node, and a directory of which node
+    // every client is on lets MessageClusterClient reach clients anywhere in the cluster.
+    // Derived servers overriding OnClientValidated or OnClientDisconnect must call the ClusterServer version
+    template<typename T, typename Protocol = asio::ip::tcp>
+    class ClusterServer : public ServerInterface<T, Protocol>
+    {
+    public:
+        using ConnectionPtr = std::shared_ptr<Connection<T, Protocol>>;
+
+        // TCP only - listen for clients on all ipv4 interfaces
+        template<typename P = Protocol, typename = std::enable_if_t<std::is_same_v<P, asio::ip::tcp>>>
+        ClusterServer(uint16_t port, const ClusterSettings& cluster, const ServerSettings& settings = {})
+            :ClusterServer(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port), cluster, settings)
+        {
+        }
+
+        ClusterServer(const typename Protocol::endpoint& endpoint, const ClusterSettings& cluster, const ServerSettings& settings = {})
+            :ServerInterface<T, Protocol>(endpoint, settings), m_Cluster(cluster), m_BusSettings(BusSettings(settings)),
+            m_Bus(*this, cluster.BusPort, m_BusSettings)
+        {
+            this->m_IDCounter = (cluster.NodeID << 24) + 10000;
+
+            for(const ClusterPeer& peer : cluster.Peers)
+                m_Peers.push_back(std::make_unique<PeerLink>(peer));
+        }
+
+        ~ClusterServer()
+        {
+            Stop();
+        }
+
+    public:
+        bool Start()
+        {
+            if(!m_Bus.Start() || !ServerInterface<T, Protocol>::Start())
+                return false;
+
+            m_bBusRunning = true;
+            m_ThrBus = std::thread([this]() { RunBus(); });
+            return true;
+        }
+
+        bool Stop()
+        {
+            if(m_ThrBus.joinable())
+            {
+                m_bBusRunning = false;
+                m_Bus.Wake();
+                m_ThrBus.join();
+            }
+
+            // Same as Reconnect, the links are taken out under the lock and torn down after it
+            std::vector<std::unique_ptr<ClientInterface<ClusterOp>>> links;
+            {
+                std::scoped_lock lock(m_MuxPeers);
+                for(auto& peer : m_Peers)
+                    links.push_back(std::move(peer->Client));
+            }
+            links.clear();
+
+            m_Bus.Stop();
+            return ServerInterface<T, Protocol>::Stop();
+        }
+
+        uint32_t GetNodeID() const
+        {
+            return m_Cluster.NodeID;
+        }
+
+        // Links from peers open on this node's bus, one per peer that is up
+        size_t InboundLinkCount()
+        {
+            return m_Bus.ConnectionCount();
+        }
+
+        // Node the client is connected to according to the directory, nullopt if the client is unknown
+        std::optional<uint32_t> FindClient(uint32_t clientID)
+        {
+            if(LocalClient(clientID))
+                return m_Cluster.NodeID;
+
+            std::scoped_lock lock(m_MuxDirectory);
+            auto it = m_Directory.find(clientID);
+            if(it == m_Directory.end())
+                return std::nullopt;
+            return it->second;
+        }
+
+        // Send to a client on any node, returns false if the client is not known to the cluster
+        bool MessageClusterClient(uint32_t clientID, const Message<T>& msg)
+        {
+            if(ConnectionPtr client = LocalClient(clientID))
+            {
+                this->MessageClient(client, msg);
+                return true;
+            }
+
+            std::optional<uint32_t> node = FindClient(clientID);
+            return node && SendToPeer(*node, Wrap(ClusterOp::Direct, msg, clientID));
+        }
+
+        // Send to every client of the cluster, the message crosses each link once
+        void MessageAllClusterClients(const Message<T>& msg, ConnectionPtr pIgnoreClient = nullptr)
+        {
+            this->MessageAllClients(msg, pIgnoreClient);
+            SendToPeers(Wrap(ClusterOp::Broadcast, msg, 0));
+        }
+
+        // Groups are kept per node, a client joins a group on the node it is connected to
+        void JoinGroup(uint32_t groupID, ConnectionPtr client)
+        {
+            std::scoped_lock lock(m_MuxGroups);
+            m_Groups[groupID].push_back(client);
+        }
+
+        void LeaveGroup(uint32_t groupID, ConnectionPtr client)
+        {
+            std::scoped_lock lock(m_MuxGroups);
+            auto it = m_Groups.find(groupID);
+            if(it == m_Groups.end())
+                return;
+
+            auto& members = it->second;
+            members.erase(std::remove_if(members.begin(), members.end(),
+                [&client](const std::weak_ptr<Connection<T, Protocol>>& member) { return member.lock() == client; }), members.end());
+            if(members.empty())
+                m_Groups.erase(it);
+        }
+
+        // Send to the members of a group on every node, the message crosses each link once
+        void MessageGroup(uint32_t groupID, const Message<T>& msg, ConnectionPtr pIgnoreClient = nullptr)
+        {
+            DeliverToGroup(groupID, msg, pIgnoreClient);
+            SendToPeers(Wrap(ClusterOp::Group, msg, groupID));
+        }
+
+    public:
+        void OnClientValidated(ConnectionPtr client) override
+        {
+            uint32_t clientID = client->GetID();
+            {
+                std::scoped_lock lock(m_MuxLocal);
+                m_LocalClients[clientID] = client;
+            }
+            SendToPeers(ClientList(ClusterOp::ClientsJoined, &clientID, 1));
+        }
+
+    protected:
+        void OnClientDisconnect(ConnectionPtr client) override
+        {
+            if(!client)
+                return;
+
+            uint32_t clientID = client->GetID();
+            {
+                std::scoped_lock lock(m_MuxLocal);
+                auto it = m_LocalClients.find(clientID);
+                if(it == m_LocalClients.end())
+                    return;
+                m_LocalClients.erase(it);
+            }
+            SendToPeers(ClientList(ClusterOp::ClientsLeft, &clientID, 1));
+        }
+
+    private:
+        // Listens for the links of the peers, frames are handled on the bus thread
+        class BusServer : public ServerInterface<ClusterOp>
+        {
+        public:
+            BusServer(ClusterServer& owner, uint16_t port, const ServerSettings& settings)
+                :ServerInterface<ClusterOp>(port, settings), m_Owner(owner)
+            {
+            }
+
+            template<typename Rep, typename Period>
+            bool WaitFor(const std::chrono::duration<Rep, Period>& timeout)
+            {
+                return this->m_QMessagesIn.WaitFor(timeout);
+            }
+
+            // Queue an empty message so a waiting bus thread returns
+            void Wake()
+            {
+                this->m_QMessagesIn.PushBack({});
+            }
+
+        protected:
+            bool OnClientConnect(std::shared_ptr<Connection<ClusterOp>> peer) override
+            {
+                return true;
+            }
+
+            void OnMessage(std::shared_ptr<Connection<ClusterOp>> peer, Message<ClusterOp> frame) override
+            {
+                if(peer)
+                    m_Owner.OnBusFrame(peer, frame);
+            }
+
+            void OnClientDisconnect(std::shared_ptr<Connection<ClusterOp>> peer) override
+            {
+                m_Owner.OnLinkClosed(peer);
+            }
+
+        private:
+            ClusterServer& m_Owner;
+        };
+
+        // Outgoing link to one peer, frames to the peer are sent here and frames from it arrive on the bus server
+        struct PeerLink
+        {
+            PeerLink(const ClusterPeer& peer) : Peer(peer) {}
+
+            ClusterPeer Peer;
+            std::unique_ptr<ClientInterface<ClusterOp>> Client;
+            std::chrono::steady_clock::time_point LastAttempt{};
+
+            bool IsUp() const { return Client && Client->IsConnected(); }
+        };
+
+        // Client ids per ClientsJoined frame, keeps the hello of a busy node well below the max frame size
+        static constexpr size_t MaxIDsPerFrame = 16 << 10;
+
+        // Wrapped messages carry a client header and the routing fields on top of the client's body
+        static ServerSettings BusSettings(const ServerSettings& settings)
+        {
+            ServerSettings bus;
+            bus.Timeouts = settings.Timeouts;
+            bus.Frames = settings.Frames;
+            bus.Frames.MaxFrameSize = std::max<uint32_t>(settings.Frames.MaxFrameSize, MaxIDsPerFrame * sizeof(uint32_t)) + 64;
+            return bus;
+        }
+
+        void RunBus()
+        {
+            while(m_bBusRunning)
+            {
+                if(m_Bus.WaitFor(m_Cluster.RetryInterval))
+                    m_Bus.Update();
+                MaintainLinks();
+            }
+        }
+
+        // Runs on the bus thread, connecting blocks on name resolution so it never happens on an io thread
+        void MaintainLinks()
+        {
+            auto tNow = std::chrono::steady_clock::now();
+            for(auto& peer : m_Peers)
+            {
+                bool bRetry = false;
+                {
+                    std::scoped_lock lock(m_MuxPeers);
+                    bRetry = !peer->IsUp() && tNow - peer->LastAttempt >= m_Cluster.RetryInterval;
+                }
+                if(bRetry)
+                    Reconnect(*peer);
+            }
+        }
+
+        // Bus thread only, it is the only thread replacing links while the server runs. The new link connects outside
+        // m_MuxPeers so senders never wait on a connect, and is greeted as it is swapped in so the hello and the full
+        // client list go out before anything else on it
+        void Reconnect(PeerLink& peer)
+        {
+            auto link = std::make_unique<ClientInterface<ClusterOp>>(m_BusSettings.Timeouts, m_BusSettings.Frames);
+            if(!link->Connect(peer.Peer.Host, peer.Peer.BusPort))
+                link.reset();
+
+            {
+                std::scoped_lock lock(m_MuxPeers);
+                peer.LastAttempt = std::chrono::steady_clock::now();
+                peer.Client.swap(link);
+                if(peer.Client)
+                    Greet(*peer.Client);
+            }
+
+            // Replaced link is destroyed here, outside the lock
+        }
+
+        // m_MuxPeers must be held so no client joining meanwhile is missing from both the list and the frames after it
+        void Greet(ClientInterface<ClusterOp>& link)
+        {
+            Message<ClusterOp> hello;
+            hello.Header.Id = ClusterOp::Hello;
+            hello << m_Cluster.NodeID;
+            link.Send(hello);
+
+            std::vector<uint32_t> clientIDs;
+            {
+                std::scoped_lock lock(m_MuxLocal);
+                clientIDs.reserve(m_LocalClients.size());
+                for(auto& [clientID, client] : m_LocalClients)
+                    clientIDs.push_back(clientID);
+            }
+            for(size_t i = 0; i < clientIDs.size(); i += MaxIDsPerFrame)
+                link.Send(ClientList(ClusterOp::ClientsJoined, clientIDs.data() + i, std::min(MaxIDsPerFrame, clientIDs.size() - i)));
+        }
+
+        bool SendToPeer(uint32_t nodeID, const Message<ClusterOp>& frame)
+        {
+            std::scoped_lock lock(m_MuxPeers);
+            for(auto& peer : m_Peers)
+            {
+                if(peer->Peer.NodeID == nodeID && peer->IsUp())
+                {
+                    peer->Client->Send(frame);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void SendToPeers(const Message<ClusterOp>& frame)
+        {
+            std::scoped_lock lock(m_MuxPeers);
+            for(auto& peer : m_Peers)
+            {
+                if(peer->IsUp())
+                    peer->Client->Send(frame);
+            }
+        }
+
+        // Bus frame layout: client body, client header, target (client or group id), sending node
+        Message<ClusterOp> Wrap(ClusterOp op, const Message<T>& msg, uint32_t target) const
+        {
+            Message<ClusterOp> frame;
+            frame.Header.Id = op;
+            frame.Body.reserve(msg.Body.size() + sizeof(MessageHeader<T>) + 2 * sizeof(uint32_t));
+            frame.Body = msg.Body;
+            frame << msg.Header << target << m_Cluster.NodeID;
+            return frame;
+        }
+
+        Message<ClusterOp> ClientList(ClusterOp op, const uint32_t* pClientIDs, size_t nCount) const
+        {
+            Message<ClusterOp> frame;
+            frame.Header.Id = op;
+            frame.Body.resize(nCount * sizeof(uint32_t));
+            if(nCount > 0)
+                memcpy(frame.Body.data(), pClientIDs, nCount * sizeof(uint32_t));
+            frame << uint32_t(nCount) << m_Cluster.NodeID;
+            return frame;
+        }
+
+        // Frames come from other nodes of the same cluster but are still checked before anything is read from them
+        template<typename DataType>
+        static bool Pop(Message<ClusterOp>& frame, DataType& data)
+        {
+            if(frame.Body.size() < sizeof(DataType))
+                return false;
+            frame >> data;
+            return true;
+        }
+
+        // m_MuxDirectory must be held
+        void ForgetNode(uint32_t nodeID)
+        {
+            for(auto it = m_Directory.begin(); it != m_Directory.end();)
+                it = it->second == nodeID ? m_Directory.erase(it) : std::next(it);
+        }
+
+        // Runs on the bus's io thread once a link from a peer closed. The clients the peer reported over it are
+        // forgotten unless the peer already replaced the link
+        void OnLinkClosed(const std::shared_ptr<Connection<ClusterOp>>& link)
+        {
+            std::scoped_lock lock(m_MuxDirectory);
+            for(auto it = m_InboundLinks.begin(); it != m_InboundLinks.end(); ++it)
+            {
+                if(it->second.lock() == link)
+                {
+                    ForgetNode(it->first);
+                    m_InboundLinks.erase(it);
+                    return;
+                }
+            }
+        }
+
+        // Runs on the bus thread
+        void OnBusFrame(const std::shared_ptr<Connection<ClusterOp>>& link, Message<ClusterOp>& frame)
+        {
+            uint32_t nodeID = 0;
+            if(!Pop(frame, nodeID))
+                return;
+
+            switch(frame.Header.Id)
+            {
+                case ClusterOp::Hello:
+                {
+                    // The link replaces any earlier one from the same peer, i.e from before the peer restarted
+                    std::shared_ptr<Connection<ClusterOp>> previous;
+                    {
+                        std::scoped_lock lock(m_MuxDirectory);
+                        ForgetNode(nodeID);
+                        if(!link->IsConnected())
+                            return;
+
+                        auto& current = m_InboundLinks[nodeID];
+                        previous = current.lock();
+                        current = link;
+                    }
+                    if(previous && previous != link)
+                        previous->Disconnect();
+
+                    // The peer just came up, link back to it now rather than on the next retry
+                    for(auto& peer : m_Peers)
+                    {
+                        bool bDown = false;
+                        {
+                            std::scoped_lock lock(m_MuxPeers);
+                            bDown = peer->Peer.NodeID == nodeID && !peer->IsUp();
+                        }
+                        if(bDown)
+                            Reconnect(*peer);
+                    }
+                    break;
+                }
+
+                case ClusterOp::ClientsJoined:
+                case ClusterOp::ClientsLeft:
+                {
+                    uint32_t nCount = 0;
+                    if(!Pop(frame, nCount) || frame.Body.size() != size_t(nCount) * sizeof(uint32_t))
+                        return;
+
+                    std::vector<uint32_t> clientIDs(nCount);
+                    if(nCount > 0)
+                        memcpy(clientIDs.data(), frame.Body.data(), frame.Body.size());
+
+                    // Frames still queued from a link that closed or was replaced are out of date
+                    std::scoped_lock lock(m_MuxDirectory);
+                    auto current = m_InboundLinks.find(nodeID);
+                    if(current == m_InboundLinks.end() || current->second.lock() != link)
+                        return;
+
+                    for(uint32_t clientID : clientIDs)
+                    {
+                        if(frame.Header.Id == ClusterOp::ClientsJoined)
+                        {
+                            m_Directory[clientID] = nodeID;
+                        }
+                        else
+                        {
+                            auto it = m_Directory.find(clientID);
+                            if(it != m_Directory.end() && it->second == nodeID)
+                                m_Directory.erase(it);
+                        }
+                    }
+                    break;
+                }
+
+                case ClusterOp::Broadcast:
+                case ClusterOp::Group:
+                case ClusterOp::Direct:
+                {
+                    uint32_t target = 0;
+                    Message<T> msg;
+                    if(!Pop(frame, target) || !Pop(frame, msg.Header))
+                        return;
+                    msg.Body = std::move(frame.Body);
+                    msg.Header.Size = static_cast<uint32_t>(msg.Body.size());
+
+                    if(frame.Header.Id == ClusterOp::Broadcast)
+                    {
+                        this->MessageAllClients(msg, nullptr);
+                    }
+                    else if(frame.Header.Id == ClusterOp::Group)
+                    {
+                        DeliverToGroup(target, msg, nullptr);
+                    }
+                    else if(ConnectionPtr client = LocalClient(target))
+                    {
+                        this->MessageClient(client, msg);
+                    }
+                    break;
+                }
+            }
+        }
+
+        ConnectionPtr LocalClient(uint32_t clientID)
+        {
+            std::scoped_lock lock(m_MuxLocal);
+            auto it = m_LocalClients.find(clientID);
+            return it != m_LocalClients.end() ? it->second.lock() : nullptr;
+        }
+
+        // Members that went away are dropped from the group as it is walked
+        void DeliverToGroup(uint32_t groupID, const Message<T>& msg, ConnectionPtr pIgnoreClient)
+        {
+            std::scoped_lock lock(m_MuxGroups);
+            auto it = m_Groups.find(groupID);
+            if(it == m_Groups.end())
+                return;
+
+            auto& members = it->second;
+            members.erase(std::remove_if(members.begin(), members.end(), [&](const std::weak_ptr<Connection<T, Protocol>>& member) {
+                ConnectionPtr client = member.lock();
+                if(!client || !client->IsConnected())
+                    return true;
+                if(client != pIgnoreClient)
+                    client->Send(msg);
+                return false;
+            }), members.end());
+
+            if(members.empty())
+                m_Groups.erase(it);
+        }
+
+    private:
+        ClusterSettings m_Cluster;
+
+        // Incoming links from the peers and the thread handling their frames
+        ServerSettings m_BusSettings;
+        BusServer m_Bus;
+        std::thread m_ThrBus;
+        std::atomic<bool> m_bBusRunning = false;
+
+        // Outgoing links to the peers
+        std::vector<std::unique_ptr<PeerLink>> m_Peers;
+        std::mutex m_MuxPeers;
+
+        // Validated clients of this node by id
+        std::unordered_map<uint32_t, std::weak_ptr<Connection<T, Protocol>>> m_LocalClients;
+        std::mutex m_MuxLocal;
+
+        // Node of every client on another node, kept up to date by the peers' ClientsJoined/ClientsLeft frames
+        std::unordered_map<uint32_t, uint32_t> m_Directory;
+        std::mutex m_MuxDirectory;
+
+        // Current link from each peer, the directory only takes updates sent over it
+        std::unordered_map<uint32_t, std::weak_ptr<Connection<ClusterOp>>> m_InboundLinks;
+
+        // Members of each group on this node
+        std::unordered_map<uint32_t, std::vector<std::weak_ptr<Connection<T, Protocol>>>> m_Groups;
+        std::mutex m_MuxGroups;
+    };
+}
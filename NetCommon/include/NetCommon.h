@@ -10,6 +10,12 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <future>
+#include <atomic>
+#include <array>
+#include <cstdio>
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
@@ -19,3 +25,5 @@
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
+
+#include "NetLog.h"
@@ -3,15 +3,53 @@
 #include <memory>
 
 #include "TSQueue.h"
+#include "CompactQueue.h"
 #include "NetMessage.h"
+#include "NetTimerWheel.h"
+#include "NetCapture.h"
+#include "NetStream.h"
 
 namespace Fumbly {
     // Forward declare server interface
-    template<typename T>
+    template<typename T, typename Protocol = asio::ip::tcp>
     class ServerInterface;
 
-    template<typename T>
-    class Connection: public std::enable_shared_from_this<Connection<T>>
+    // Connection timeouts, zero disables
+    struct TimeoutSettings
+    {
+        // Time allowed from connect until the validation handshake completes
+        std::chrono::milliseconds Handshake{5000};
+
+        // Connection is closed if nothing (not even a heartbeat) is received for this long
+        std::chrono::milliseconds Idle{30000};
+
+        // A heartbeat is sent if nothing else was sent during this interval, should be well below the peer's idle timeout
+        std::chrono::milliseconds Heartbeat{10000};
+    };
+
+    // Sockets that can wait for readability without a buffer (tcp, local), see Connection::ReadSome
+    template<typename Socket, typename = void>
+    struct CanWaitRead : std::false_type {};
+
+    template<typename Socket>
+    struct CanWaitRead<Socket, std::void_t<decltype(Socket::wait_read)>> : std::true_type {};
+
+    // Waiting for readability and then reading takes two operations. Under epoll the wait rides on the reactor's
+    // readiness events, under io_uring it is a poll request of its own, so io_uring builds read into a buffer instead.
+    // Define as 0 to force the buffered path on epoll
+#if !defined(FUMBLY_WAIT_BEFORE_READ)
+#if defined(ASIO_HAS_IO_URING) && defined(ASIO_DISABLE_EPOLL)
+#define FUMBLY_WAIT_BEFORE_READ 0
+#else
+#define FUMBLY_WAIT_BEFORE_READ 1
+#endif
+#endif
+
+    template<typename Socket>
+    struct WaitBeforeRead : std::bool_constant<FUMBLY_WAIT_BEFORE_READ && CanWaitRead<Socket>::value> {};
+
+    template<typename T, typename Protocol>
+    class Connection: public std::enable_shared_from_this<Connection<T, Protocol>>
     {
     public:
         enum class Owner
@@ -21,11 +59,21 @@ namespace Fumbly {
             Client
         };
 
-        Connection(Owner owner, asio::io_context& asioContext, asio::ip::tcp::socket socket, TSQueue<OwnedMessage<T>>& qIn)
-            :m_AsioContext(asioContext), m_Socket(std::move(socket)), m_QMessagesIn(qIn)
+        Connection(Owner owner, asio::io_context& asioContext, typename Protocol::socket socket, TSQueue<OwnedMessage<T, Protocol>>& qIn,
+            TimerWheel* pTimerWheel = nullptr, const TimeoutSettings& timeouts = {}, const FrameSettings& frames = {})
+            :m_AsioContext(asioContext), m_Socket(std::move(socket)), m_QMessagesIn(qIn), m_pTimerWheel(pTimerWheel), m_Timeouts(timeouts), m_Frames(frames)
         {
             m_OwnerType = owner;
 
+            for(size_t i = 0; i < PriorityCount; i++)
+            {
+                m_Lanes[i].Quantum = int64_t(m_Frames.LaneWeights[i]) * std::max<uint32_t>(1, m_Frames.LaneQuantum);
+                m_Lanes[i].Deficit = m_Lanes[i].Quantum;
+            }
+
+            m_TimerTimeout.Callback = [this]() { OnTimeout(); };
+            m_TimerHeartbeat.Callback = [this]() { OnHeartbeat(); };
+
             // Validation paths
             if(m_OwnerType == Owner::Server)
             {
@@ -41,17 +89,24 @@ namespace Fumbly {
                 m_HandshakeOut = 0;
             }
         }
-        ~Connection(){}
+        ~Connection()
+        {
+            CancelTimers();
+        }
 
     public:
         // Connection provides unique ID to client and prime context for messages
-        void ConnectToClient(ServerInterface<T>* server, uint32_t uid = 0)
+        void ConnectToClient(ServerInterface<T, Protocol>* server, uint32_t uid = 0)
         {
             if (m_OwnerType == Owner::Server)
             {
                 if (m_Socket.is_open())
                 {
                     m_ID = uid;
+                    ConfigureSocket();
+
+                    // Client must complete the handshake in time
+                    ArmTimer(m_TimerTimeout, m_Timeouts.Handshake);
 
                     // Send validation data to client trying to connect
                     WriteValidation();
@@ -62,33 +117,49 @@ namespace Fumbly {
             }
         }
 
-        void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints)
+        // Endpoints is any asio endpoint sequence (resolver results, vector of endpoints)
+        template<typename EndpointSequence>
+        void ConnectToServer(const EndpointSequence& endpoints)
         {
             // Give asio async task
             if(m_OwnerType == Owner::Client)
             {
+                ArmTimer(m_TimerTimeout, m_Timeouts.Handshake);
+
                 asio::async_connect(m_Socket, endpoints,
-                [this](std::error_code ec, asio::ip::tcp::endpoint endpoint){
+                [this](std::error_code ec, const typename Protocol::endpoint& endpoint){
                     if(!ec)
                     {
+                        ConfigureSocket();
                         ReadValidation();
                     }
                     else
                     {
-                        std::cout << "[" << m_ID << "] Connect to Server Fail.\n";
-                        m_Socket.close();
+                        FUMBLY_LOG_WARN("[", m_ID, "] Connect to Server Fail.");
+                        Close();
                     }
                 });
             }
         }
 
+        // Socket was handed over already connected (i.e a socket pair), go straight to the handshake
+        void ConnectToServer()
+        {
+            if(m_OwnerType == Owner::Client)
+            {
+                ArmTimer(m_TimerTimeout, m_Timeouts.Handshake);
+                ConfigureSocket();
+                ReadValidation();
+            }
+        }
+
         // Can be called by client or server
         void Disconnect()
         {
             if(IsConnected())
             {
                 // Prime Asio to disconnect
-                asio::post(m_AsioContext, [this]() {m_Socket.close(); });
+                asio::post(m_AsioContext, [this]() {Close(); });
             }
         }
         bool IsConnected() const
@@ -98,130 +169,618 @@ namespace Fumbly {
 
         uint32_t GetID() {return m_ID;}
 
+        // Messages handed to Send that have not been completely written yet, safe to call from any thread
+        size_t OutgoingCount() const
+        {
+            return m_nOutgoing.load(std::memory_order_relaxed);
+        }
+
+#if defined(FUMBLY_HAS_CAPTURE)
+        // Record every frame sent and received on this connection, must be set before the connection starts
+        void SetCapture(CaptureLog* pCapture)
+        {
+            m_pCapture = pCapture;
+        }
+#endif
+
+        // Handler is given first look at each incoming message, returning true consumes it before it reaches the queue
+        void SetIncomingHandler(std::function<bool(Message<T>&)> handler)
+        {
+            m_FnIncomingHandler = std::move(handler);
+        }
+
+        // Handler receives the chunks of incoming streams on the asio thread as they arrive, without a handler streams are discarded
+        void SetStreamHandler(std::function<void(const StreamChunk<T>&)> handler)
+        {
+            m_FnStreamHandler = std::move(handler);
+        }
+
+        // Handler runs on the asio thread once, when the connection closes for any reason (error, timeout, Disconnect)
+        void SetCloseHandler(std::function<void()> handler)
+        {
+            m_FnCloseHandler = std::move(handler);
+        }
+
+        // Lane used by Send for each message type, types not in the map go to Priority::Normal. The map is owned by
+        // the client/server and must not change while connections are running
+        void SetPriorities(const std::unordered_map<T, Priority>* pPriorities)
+        {
+            m_pPriorities = pPriorities;
+        }
+
     public:
+        // Messages must fit in a frame, larger payloads have to be sent with SendStream
         void Send(const Message<T>& msg)
         {
-            asio::post(m_AsioContext, [this, msg]() {
-                bool isWritingMessages = !m_QMessagesOut.Empty();
-                m_QMessagesOut.PushBack(msg);
+            Send(msg, PriorityOf(msg.Header.Id));
+        }
 
-                // Check if asio context has already begun the loop of writing messages
-                if (!isWritingMessages)
+        // Send on an explicit lane, overriding the lane of the message type
+        void Send(const Message<T>& msg, Priority priority)
+        {
+            if(msg.Body.size() > m_Frames.MaxFrameSize)
+            {
+                FUMBLY_LOG_ERROR("[", m_ID, "] Message of ", msg.Body.size(), " bytes exceeds max frame size, not sent");
+                return;
+            }
+
+            m_nOutgoing.fetch_add(1, std::memory_order_relaxed);
+            asio::post(m_AsioContext, [this, msg, priority]() mutable {
+                QueueMessage(std::move(msg), priority);
+                });
+        }
+
+        // Send a payload of any size as a stream of chunks, the write loop alternates between chunks and the lane's
+        // queued messages so a large transfer never holds up regular traffic. Returns the stream id seen by the receiver
+        uint32_t SendStream(T id, std::vector<uint8_t> payload, Priority priority = Priority::Bulk)
+        {
+            uint32_t streamID = m_StreamCounter.fetch_add(1, std::memory_order_relaxed);
+            m_nOutgoing.fetch_add(1, std::memory_order_relaxed);
+            asio::post(m_AsioContext, [this, priority, stream = OutgoingStream{streamID, id, std::move(payload), 0}]() mutable {
+                m_Lanes[size_t(priority)].Streams.PushBack(std::move(stream));
+                if(!m_bWriting && m_bValidated)
                 {
-                    WriteHeader();
+                    WriteNext();
                 }
                 });
+            return streamID;
         }
 
     private:
-        // ASYNC - Prime Context ready to read a message header
-        void ReadHeader()
+        struct OutgoingStream
         {
-            asio::async_read(m_Socket, asio::buffer(&m_MsgTemporaryIn.Header, sizeof(MessageHeader<T>)), 
-            [this](std::error_code ec, std::size_t length) {
-                if(!ec)
+            uint32_t StreamID;
+            T Id;
+            std::vector<uint8_t> Payload;
+            uint64_t Offset;
+        };
+
+        struct IncomingStream
+        {
+            T Id;
+            uint64_t Offset;
+            uint64_t TotalSize;
+        };
+
+        // Frame header and chunk header of the chunk being written, the payload is written from the stream itself
+        struct ChunkFrame
+        {
+            MessageHeader<T> Header;
+            StreamChunkHeader Chunk;
+        };
+
+        // Messages and streams waiting to be sent to the remote side, one lane per Priority. Only touched on the asio thread
+        struct Lane
+        {
+            CompactQueue<Message<T>> Messages;
+            CompactQueue<OutgoingStream> Streams;
+
+            // Bytes this lane may still write in the current round, 0 quantum is strict priority
+            int64_t Deficit = 0;
+            int64_t Quantum = 0;
+            bool bStreamTurn = false;
+
+            bool Empty() const { return Messages.Empty() && Streams.Empty(); }
+        };
+
+        Priority PriorityOf(T id) const
+        {
+            if(m_pPriorities)
+            {
+                auto it = m_pPriorities->find(id);
+                if(it != m_pPriorities->end())
+                    return it->second;
+            }
+            return Priority::Normal;
+        }
+
+        // Must be called on the asio thread, msg is moved into the lane
+        void QueueMessage(Message<T> msg, Priority priority)
+        {
+            // The body written is always the whole body, the header must agree with it
+            msg.Header.Size = static_cast<uint32_t>(msg.Body.size());
+#if defined(FUMBLY_HAS_CAPTURE)
+            if(m_pCapture)
+                m_pCapture->Append(CaptureDirection::Out, m_ID, msg);
+#endif
+
+            Lane& lane = m_Lanes[size_t(priority)];
+            lane.Messages.PushBack(std::move(msg));
+            m_bSentSinceHeartbeat = true;
+
+            // Check if asio context has already begun the loop of writing messages, nothing may be written before the handshake
+            if (!m_bWriting && m_bValidated)
+            {
+                WriteNext();
+            }
+        }
+
+        // Gather the next frames to write. Consecutive messages are batched into one gather write (a single
+        // sendmsg, or a single submission with io_uring) until a stream chunk is due or the batch is full,
+        // within a lane queued messages and stream chunks take turns
+        void WriteNext()
+        {
+            size_t nBatchBytes = 0;
+            while(m_WriteBatch.size() < MaxBatchFrames && nBatchBytes < m_Frames.WriteBatchBytes)
+            {
+                Lane* pLane = NextLane();
+                if(!pLane)
+                    break;
+
+                if(!pLane->Streams.Empty() && (pLane->bStreamTurn || pLane->Messages.Empty()))
+                {
+                    // Chunks are written on their own straight from the stream's buffer
+                    if(!m_WriteBatch.empty())
+                        break;
+
+                    m_bWriting = true;
+                    WriteChunk(*pLane);
+                    return;
+                }
+
+                size_t nFrame = sizeof(MessageHeader<T>) + pLane->Messages.Front().Body.size();
+                m_WriteBatch.push_back(std::move(pLane->Messages.Front()));
+                pLane->Messages.PopFront();
+                pLane->bStreamTurn = true;
+                Charge(*pLane, nFrame);
+                nBatchBytes += nFrame;
+            }
+
+            m_bWriting = !m_WriteBatch.empty();
+            if(m_bWriting)
+            {
+                WriteBatch();
+            }
+            else if(WriteStorageBytes() > MaxIdleWriteStorage)
+            {
+                // Storage grown by a burst is given back as soon as the write loop goes idle, the little that
+                // request/response traffic needs is kept for the next message until a quiet heartbeat interval
+                ReleaseWriteStorage();
+            }
+        }
+
+        size_t WriteStorageBytes() const
+        {
+            size_t nBytes = m_WriteBatch.capacity() * sizeof(Message<T>) + m_WriteBuffers.capacity() * sizeof(asio::const_buffer);
+            for(const Lane& lane : m_Lanes)
+                nBytes += lane.Messages.Capacity() * sizeof(Message<T>) + lane.Streams.Capacity() * sizeof(OutgoingStream);
+            return nBytes;
+        }
+
+        // Only while the write loop is idle
+        void ReleaseWriteStorage()
+        {
+            std::vector<Message<T>>().swap(m_WriteBatch);
+            std::vector<asio::const_buffer>().swap(m_WriteBuffers);
+            for(Lane& lane : m_Lanes)
+            {
+                lane.Messages.Release();
+                lane.Streams.Release();
+            }
+        }
+
+        // Deficit round robin over bytes: strict priority lanes first, then the highest priority lane that still has
+        // credit. Once every waiting lane is out of credit each gets its quantum again, so bulk traffic can only
+        // delay a realtime frame by about one quantum and is itself never starved
+        Lane* NextLane()
+        {
+            while(true)
+            {
+                bool bPending = false;
+                for(Lane& lane : m_Lanes)
                 {
-                    // Check if message has body
-                    if(m_MsgTemporaryIn.Header.Size > 0)
+                    if(lane.Empty())
+                        continue;
+
+                    bPending = true;
+                    if(lane.Quantum == 0 || lane.Deficit > 0)
+                        return &lane;
+                }
+
+                if(!bPending)
+                    return nullptr;
+
+                for(Lane& lane : m_Lanes)
+                {
+                    if(!lane.Empty())
+                        lane.Deficit += lane.Quantum;
+                }
+            }
+        }
+
+        // Frame of size bytes was taken from lane
+        void Charge(Lane& lane, size_t size)
+        {
+            lane.Deficit -= int64_t(size);
+
+            // A lane that drained starts over with a full quantum so its next frame is not held back
+            if(lane.Empty())
+                lane.Deficit = lane.Quantum;
+        }
+
+        // ASYNC - Prime Context to read whatever the socket has next. Sockets that wait for readability are only
+        // read once data is there, into a buffer shared by every connection of the io thread, so an idle connection
+        // holds no receive buffer. Other sockets read into the connection's own pending buffer, which stays small
+        // while the connection is quiet
+        void ReadSome()
+        {
+            // Body of the last frame is done with, large ones must not stay allocated while idle
+            std::vector<uint8_t>().swap(m_MsgTemporaryIn.Body);
+
+            if constexpr (WaitBeforeRead<typename Protocol::socket>::value)
+            {
+                m_Socket.async_wait(Protocol::socket::wait_read,
+                [this](std::error_code ec) {
+                    if(!ec)
+                    {
+                        ReadAvailable();
+                    }
+                    else
+                    {
+                        FUMBLY_LOG_INFO("[", m_ID, "] Read Fail.");
+                        Close();
+                    }
+                });
+            }
+            else
+            {
+                // Full size reads while data keeps coming, a small one (and the large buffer released) once a read
+                // left nothing behind. Costs a second read for frames that do not fit the small one
+                size_t nPending = m_RecvPending.size();
+                size_t nBuffer = m_bRecvBusy ? ReceiveBufferSize() : std::min(ReceiveBufferSize(), nPending + IdleReadSize);
+                if(m_RecvPending.capacity() > 2 * nBuffer)
+                    std::vector<uint8_t>(m_RecvPending).swap(m_RecvPending);
+                m_RecvPending.resize(nBuffer);
+
+                m_Socket.async_read_some(asio::buffer(m_RecvPending.data() + nPending, m_RecvPending.size() - nPending),
+                [this, nPending](std::error_code ec, std::size_t length) {
+                    if(!ec)
                     {
-                        // Allocate enough space on temporary msg buffer for msg
-                        m_MsgTemporaryIn.Body.resize(m_MsgTemporaryIn.Header.Size);
-                        ReadBody();
+                        // Any traffic proves the peer is alive
+                        ArmTimer(m_TimerTimeout, m_Timeouts.Idle);
+
+                        size_t nConsumed = 0;
+                        if(!DispatchFrames(m_RecvPending.data(), nPending + length, nConsumed))
+                        {
+                            m_RecvPending.clear();
+                            return;
+                        }
+
+                        // Caught up with the peer, the next read may wait a long time
+                        m_bRecvBusy = nPending + length == m_RecvPending.size() || nConsumed < nPending + length;
+
+                        // Move the partial frame to the front so the next read appends to it
+                        m_RecvPending.resize(nPending + length);
+                        m_RecvPending.erase(m_RecvPending.begin(), m_RecvPending.begin() + nConsumed);
+                        ReadSome();
                     }
                     else
                     {
-                        AddToIncomingMessageQueue();
+                        FUMBLY_LOG_INFO("[", m_ID, "] Read Fail.");
+                        Close();
                     }
-                } 
-                else            
+                });
+            }
+        }
+
+        // Socket is readable, read behind the partial frame kept from the last read and dispatch every complete frame.
+        // Only the partial frame left at the end is copied into the connection
+        void ReadAvailable()
+        {
+            thread_local std::vector<uint8_t> buffer;
+            if(buffer.size() < ReceiveBufferSize())
+                buffer.resize(ReceiveBufferSize());
+
+            while(true)
+            {
+                size_t nPending = m_RecvPending.size();
+                if(nPending > 0)
+                    memcpy(buffer.data(), m_RecvPending.data(), nPending);
+
+                asio::error_code ec;
+                size_t length = m_Socket.read_some(asio::buffer(buffer.data() + nPending, buffer.size() - nPending), ec);
+                if(ec == asio::error::would_block || ec == asio::error::try_again)
+                    break;
+                if(ec)
                 {
-                    std::cout << "[" << m_ID << "] Read Header Fail.\n";
-                    m_Socket.close();
+                    FUMBLY_LOG_INFO("[", m_ID, "] Read Fail.");
+                    Close();
+                    return;
                 }
-            });
+
+                // Any traffic proves the peer is alive
+                ArmTimer(m_TimerTimeout, m_Timeouts.Idle);
+
+                size_t nConsumed = 0;
+                if(!DispatchFrames(buffer.data(), nPending + length, nConsumed))
+                {
+                    std::vector<uint8_t>().swap(m_RecvPending);
+                    return;
+                }
+
+                if(nConsumed == nPending + length)
+                    std::vector<uint8_t>().swap(m_RecvPending);
+                else
+                    m_RecvPending.assign(buffer.data() + nConsumed, buffer.data() + nPending + length);
+
+                // A read that did not fill the buffer emptied the socket
+                if(nPending + length < buffer.size())
+                    break;
+            }
+            ReadSome();
         }
 
-        // ASYNC - Prime Context ready to read a message body
-        void ReadBody()
+        // Dispatch every complete frame in [pData, pData + nSize), nConsumed is set to the bytes used. Returns false when
+        // the read loop must not continue, the connection closed or the rest of a large frame is read into its body
+        bool DispatchFrames(const uint8_t* pData, size_t nSize, size_t& nConsumed)
         {
-            asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.Body.data(), m_MsgTemporaryIn.Header.Size),
+            nConsumed = 0;
+            while(nSize - nConsumed >= sizeof(MessageHeader<T>))
+            {
+                const uint8_t* pFrame = pData + nConsumed;
+                size_t nAvailable = nSize - nConsumed - sizeof(MessageHeader<T>);
+                memcpy(&m_MsgTemporaryIn.Header, pFrame, sizeof(MessageHeader<T>));
+                uint32_t nBody = m_MsgTemporaryIn.Header.Size;
+
+                // Never trust the size claimed by the peer beyond the configured limit
+                if(nBody > m_Frames.MaxFrameSize)
+                {
+                    FUMBLY_LOG_WARN("[", m_ID, "] Frame of ", nBody, " bytes exceeds max frame size.");
+                    Close();
+                    return false;
+                }
+
+                if(nAvailable >= nBody)
+                {
+                    m_MsgTemporaryIn.Body.assign(pFrame + sizeof(MessageHeader<T>), pFrame + sizeof(MessageHeader<T>) + nBody);
+                    nConsumed += sizeof(MessageHeader<T>) + nBody;
+                    if(!AddToIncomingMessageQueue())
+                        return false;
+                }
+                else if(sizeof(MessageHeader<T>) + nBody > ReceiveBufferSize())
+                {
+                    // Frame can never fit the buffer, keep what arrived and read the rest straight into the body
+                    m_MsgTemporaryIn.Body.resize(nBody);
+                    memcpy(m_MsgTemporaryIn.Body.data(), pFrame + sizeof(MessageHeader<T>), nAvailable);
+                    nConsumed = nSize;
+                    ReadBody(nAvailable);
+                    return false;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            return true;
+        }
+
+        size_t ReceiveBufferSize() const
+        {
+            return std::max<size_t>(sizeof(MessageHeader<T>), m_Frames.ReceiveBufferSize);
+        }
+
+        // ASYNC - Prime Context ready to read the rest of a large message body, starting at offset
+        void ReadBody(size_t offset)
+        {
+            asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.Body.data() + offset, m_MsgTemporaryIn.Body.size() - offset),
             [this](std::error_code ec, std::size_t length) {
                 if(!ec)
                 {
-                    AddToIncomingMessageQueue();
+                    ArmTimer(m_TimerTimeout, m_Timeouts.Idle);
+                    if(AddToIncomingMessageQueue())
+                        ReadSome();
                 }
                 else
                 {
-                    std::cout << "[" << m_ID << "] Read Body Fail.\n";
-                    m_Socket.close();
+                    FUMBLY_LOG_INFO("[", m_ID, "] Read Body Fail.");
+                    Close();
                 }
             });
         }
 
-        // ASYNC - Prime Context ready to write a message header
-        void WriteHeader()
+        // ASYNC - Prime Context ready to write the batch of messages, headers and bodies in a single gather write
+        void WriteBatch()
         {
-            asio::async_write(m_Socket, asio::buffer(&m_QMessagesOut.Front().Header, sizeof(MessageHeader<T>)),
+            m_WriteBuffers.clear();
+            for(const Message<T>& msg : m_WriteBatch)
+            {
+                m_WriteBuffers.push_back(asio::buffer(&msg.Header, sizeof(MessageHeader<T>)));
+                if(!msg.Body.empty())
+                    m_WriteBuffers.push_back(asio::buffer(msg.Body));
+            }
+
+            asio::async_write(m_Socket, m_WriteBuffers,
             [this](std::error_code ec, std::size_t length){
                 if(!ec)
                 {
-                    // Check if message at the front of the queue has a body to send
-                    if(m_QMessagesOut.Front().Body.size() > 0)
-                    {
-                        WriteBody();
-                    }
-                    else
-                    {
-                        m_QMessagesOut.PopFront();
-                        if(!m_QMessagesOut.Empty())
-                        {
-                            WriteHeader();
-                        }
-                    }
+                    m_nOutgoing.fetch_sub(m_WriteBatch.size(), std::memory_order_relaxed);
+                    m_WriteBatch.clear();
+                    WriteNext();
                 }
                 else
                 {
-                    std::cout << "[" << m_ID << "] Write Header Fail.\n";
-                    m_Socket.close();
+                    FUMBLY_LOG_INFO("[", m_ID, "] Write Fail.");
+                    Close();
                 }
             });
         }
 
-        // ASYNC - Prime Context ready to write a message body
-        void WriteBody()
+        // ASYNC - Prime Context ready to write the next chunk of the lane's front stream, header, chunk header and
+        // payload go out in a single gather write straight from the stream's buffer
+        void WriteChunk(Lane& lane)
         {
-            asio::async_write(m_Socket, asio::buffer(m_QMessagesOut.Front().Body.data(), m_QMessagesOut.Front().Header.Size), 
-            [this](std::error_code ec, std::size_t length){
+            OutgoingStream& stream = lane.Streams.Front();
+
+            // The chunk header counts towards the frame, a whole chunk frame has to stay within MaxFrameSize
+            size_t nMaxChunk = m_Frames.MaxFrameSize > sizeof(StreamChunkHeader) ? m_Frames.MaxFrameSize - sizeof(StreamChunkHeader) : 1;
+            size_t nChunk = std::min<size_t>({std::max<size_t>(1, m_Frames.StreamChunkSize), nMaxChunk, stream.Payload.size() - stream.Offset});
+
+            m_ChunkOut.Header.Id = stream.Id;
+            m_ChunkOut.Header.Size = static_cast<uint32_t>(sizeof(StreamChunkHeader) + nChunk);
+            m_ChunkOut.Header.Flags = MessageFlags::StreamChunk;
+            m_ChunkOut.Chunk.StreamID = stream.StreamID;
+            m_ChunkOut.Chunk.Offset = stream.Offset;
+            m_ChunkOut.Chunk.TotalSize = stream.Payload.size();
+
+            std::array<asio::const_buffer, 3> buffers{
+                asio::buffer(&m_ChunkOut.Header, sizeof(MessageHeader<T>)),
+                asio::buffer(&m_ChunkOut.Chunk, sizeof(StreamChunkHeader)),
+                asio::buffer(stream.Payload.data() + stream.Offset, nChunk)
+            };
+            asio::async_write(m_Socket, buffers,
+            [this, &lane, nChunk](std::error_code ec, std::size_t length){
                 if(!ec)
                 {
-                    m_QMessagesOut.PopFront();
-                    if(!m_QMessagesOut.Empty())
+                    OutgoingStream& stream = lane.Streams.Front();
+                    stream.Offset += nChunk;
+                    if(stream.Offset >= stream.Payload.size())
+                    {
+                        lane.Streams.PopFront();
+                        m_nOutgoing.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                    else if(lane.Streams.Count() > 1)
                     {
-                        WriteHeader();
+                        // Round robin between streams, taken out first as the push may reallocate the queue under it
+                        OutgoingStream next = std::move(stream);
+                        lane.Streams.PopFront();
+                        lane.Streams.PushBack(std::move(next));
                     }
+
+                    m_bSentSinceHeartbeat = true;
+                    lane.bStreamTurn = false;
+                    Charge(lane, length);
+                    WriteNext();
                 }
                 else
                 {
-                    std::cout << "[" << m_ID << "] Write Body Fail.\n";
-                    m_Socket.close();
+                    FUMBLY_LOG_INFO("[", m_ID, "] Write Chunk Fail.");
+                    Close();
                 }
             });
         }
 
-        void AddToIncomingMessageQueue()
+        // Returns false if the frame closed the connection
+        bool AddToIncomingMessageQueue()
         {
-            if(m_OwnerType == Owner::Server)
+#if defined(FUMBLY_HAS_CAPTURE)
+            if(m_pCapture)
+                m_pCapture->Append(CaptureDirection::In, m_ID, m_MsgTemporaryIn);
+#endif
+            if(m_MsgTemporaryIn.Header.Flags & MessageFlags::Heartbeat)
+            {
+                // Heartbeats only exist to reset the idle timeout
+            }
+            else if(m_MsgTemporaryIn.Header.Flags & MessageFlags::StreamChunk)
+            {
+                if(!ReadStreamChunk())
+                {
+                    FUMBLY_LOG_WARN("[", m_ID, "] Invalid stream chunk.");
+                    Close();
+                    return false;
+                }
+            }
+            else if(m_FnIncomingHandler && m_FnIncomingHandler(m_MsgTemporaryIn))
+            {
+                // Message was consumed by handler (i.e rpc response)
+            }
+            else if(m_OwnerType == Owner::Server)
             {
                 // Push message into QueueMessagesIn as owned message with shared pointer to connection
-                m_QMessagesIn.PushBack({this->shared_from_this(), m_MsgTemporaryIn});
+                m_QMessagesIn.PushBack({this->shared_from_this(), std::move(m_MsgTemporaryIn)});
             }
             else
             {
                 // It is assumed the message comes from the server
-                m_QMessagesIn.PushBack({nullptr, m_MsgTemporaryIn});
+                m_QMessagesIn.PushBack({nullptr, std::move(m_MsgTemporaryIn)});
             }
-            // Give asio another async task (reading more messages)
-            ReadHeader();
+            return true;
+        }
+
+        // Validate the chunk in m_MsgTemporaryIn against the stream's progress and hand it to the stream handler,
+        // returns false on a protocol violation
+        bool ReadStreamChunk()
+        {
+            const std::vector<uint8_t>& body = m_MsgTemporaryIn.Body;
+            if(body.size() < sizeof(StreamChunkHeader))
+                return false;
+
+            StreamChunkHeader header;
+            memcpy(&header, body.data(), sizeof(StreamChunkHeader));
+
+            StreamChunk<T> chunk;
+            chunk.ConnectionID = m_ID;
+            chunk.StreamID = header.StreamID;
+            chunk.Id = m_MsgTemporaryIn.Header.Id;
+            chunk.Offset = header.Offset;
+            chunk.TotalSize = header.TotalSize;
+            chunk.Data = body.data() + sizeof(StreamChunkHeader);
+            chunk.Size = body.size() - sizeof(StreamChunkHeader);
+
+            // Chunks of a stream arrive in order, each must continue exactly where the previous one ended
+            auto it = m_StreamsIn.find(header.StreamID);
+            uint64_t nExpected = it != m_StreamsIn.end() ? it->second.Offset : 0;
+            if(header.Offset != nExpected || header.Offset > header.TotalSize || chunk.Size > header.TotalSize - header.Offset)
+                return false;
+
+            if(chunk.IsLast())
+            {
+                if(it != m_StreamsIn.end())
+                    m_StreamsIn.erase(it);
+            }
+            else if(it != m_StreamsIn.end())
+            {
+                it->second.Offset += chunk.Size;
+            }
+            else
+            {
+                if(m_StreamsIn.size() >= m_Frames.MaxIncomingStreams)
+                    return false;
+                m_StreamsIn.emplace(header.StreamID, IncomingStream{chunk.Id, chunk.Size, chunk.TotalSize});
+            }
+
+            if(m_FnStreamHandler)
+                m_FnStreamHandler(chunk);
+            return true;
+        }
+
+        // Streams still in progress when the connection closes are reported as aborted
+        void AbortIncomingStreams()
+        {
+            for(auto& [streamID, stream] : m_StreamsIn)
+            {
+                if(m_FnStreamHandler)
+                {
+                    StreamChunk<T> chunk;
+                    chunk.ConnectionID = m_ID;
+                    chunk.StreamID = streamID;
+                    chunk.Id = stream.Id;
+                    chunk.Offset = stream.Offset;
+                    chunk.TotalSize = stream.TotalSize;
+                    chunk.Aborted = true;
+                    m_FnStreamHandler(chunk);
+                }
+            }
+            m_StreamsIn.clear();
         }
 
         // "Encrypt data"
@@ -239,18 +798,21 @@ namespace Fumbly {
                 if(!ec)
                 {
                     if(m_OwnerType == Owner::Client)
-                        ReadHeader();
+                    {
+                        StartKeepAlive();
+                        ReadSome();
+                    }
                 }
                 else
                 {
-                    std::cout << "Failed to sent validation message!\n";
-                    m_Socket.close();
+                    FUMBLY_LOG_WARN("[", m_ID, "] Failed to sent validation message!");
+                    Close();
                 }
             });
         }
 
         // Async - Used by both server and client to read validation messages sent
-        void ReadValidation(ServerInterface<T>* server = nullptr)
+        void ReadValidation(ServerInterface<T, Protocol>* server = nullptr)
         {
             asio::async_read(m_Socket, asio::buffer(&m_HandshakeIn, sizeof(uint64_t)),
                 [this, server](asio::error_code ec, std::size_t length)
@@ -262,16 +824,17 @@ namespace Fumbly {
                             if (m_HandshakeIn == m_HandshakeCheck)
                             {
                                 // Call client validation callback
-                                std::cout << "Client Validated" << std::endl;
+                                FUMBLY_LOG_INFO("[", m_ID, "] Client Validated");
                                 server->OnClientValidated(this->shared_from_this());
+                                StartKeepAlive();
 
                                 // Begin Async Read Loop
-                                ReadHeader();
+                                ReadSome();
                             }
                             else
                             {
-                                std::cout << "Client Disconected (Failed to validate message!)\n";
-                                m_Socket.close();
+                                FUMBLY_LOG_WARN("[", m_ID, "] Client Disconected (Failed to validate message!)");
+                                Close();
                             }
                         }
                         else if (m_OwnerType == Owner::Client)
@@ -285,26 +848,123 @@ namespace Fumbly {
                     }
                     else
                     {
-                        std::cout << "Client Disconected (Failed to read validation message!)\n";
-                        m_Socket.close();
+                        FUMBLY_LOG_WARN("[", m_ID, "] Client Disconected (Failed to read validation message!)");
+                        Close();
                     }
                 });
         }
+        // The write loop already coalesces queued frames into one write, Nagle would only add delay to the last one.
+        // Sockets read after a readiness wait must not block when the wakeup turns out to be spurious
+        void ConfigureSocket()
+        {
+            asio::error_code ec;
+            if constexpr (std::is_same_v<Protocol, asio::ip::tcp>)
+            {
+                m_Socket.set_option(asio::ip::tcp::no_delay(true), ec);
+            }
+            if constexpr (WaitBeforeRead<typename Protocol::socket>::value)
+            {
+                m_Socket.non_blocking(true, ec);
+            }
+        }
+
+        // Timers are unlinked before the socket closes so a closed connection is never referenced by the wheel
+        void Close()
+        {
+            CancelTimers();
+            m_Socket.close();
+            AbortIncomingStreams();
+
+            if(m_FnCloseHandler)
+            {
+                // Reset first, Close is reached again by the operations the close aborted
+                std::function<void()> handler = std::move(m_FnCloseHandler);
+                m_FnCloseHandler = nullptr;
+                handler();
+            }
+        }
+
+        void ArmTimer(TimerNode& timer, std::chrono::milliseconds timeout)
+        {
+            if(m_pTimerWheel && timeout.count() > 0)
+                m_pTimerWheel->Schedule(timer, timeout);
+        }
+
+        void CancelTimers()
+        {
+            if(m_pTimerWheel)
+            {
+                m_pTimerWheel->Cancel(m_TimerTimeout);
+                m_pTimerWheel->Cancel(m_TimerHeartbeat);
+            }
+        }
+
+        // Handshake done, switch from handshake timeout to idle timeout and heartbeats
+        void StartKeepAlive()
+        {
+            m_bValidated = true;
+            ArmTimer(m_TimerTimeout, m_Timeouts.Idle);
+            ArmTimer(m_TimerHeartbeat, m_Timeouts.Heartbeat);
+
+            // Messages sent during the handshake were held back
+            if(!m_bWriting)
+            {
+                WriteNext();
+            }
+        }
+
+        void OnTimeout()
+        {
+            FUMBLY_LOG_INFO("[", m_ID, "] Connection Timed Out (", m_bValidated ? "idle" : "handshake", ")");
+            Close();
+        }
+
+        void OnHeartbeat()
+        {
+            // Only fill gaps, regular traffic already keeps the peer's idle timer alive
+            if(!m_bSentSinceHeartbeat)
+            {
+                // Nothing was sent for a whole interval, the write storage kept for the next message is not needed
+                if(!m_bWriting)
+                    ReleaseWriteStorage();
+
+                Message<T> heartbeat;
+                heartbeat.Header.Flags = MessageFlags::Heartbeat;
+                m_nOutgoing.fetch_add(1, std::memory_order_relaxed);
+                QueueMessage(std::move(heartbeat), Priority::Control);
+            }
+            m_bSentSinceHeartbeat = false;
+            ArmTimer(m_TimerHeartbeat, m_Timeouts.Heartbeat);
+        }
+
     protected:
         // Unique socket to a remote held by connection
-        asio::ip::tcp::socket m_Socket;
+        typename Protocol::socket m_Socket;
 
         // Client/Server will provide the local application context
         asio::io_context& m_AsioContext;
 
-        // Queue holds all messages to be sent to the remote side of this connection
-        TSQueue<Message<T>> m_QMessagesOut;
-
         // Client/Server provides queue queue holds all messages that have been recieved from the remote side of this connection. 
         // It is a reference as the owner of this connection is expected to provide a queue
-        TSQueue<OwnedMessage<T>>& m_QMessagesIn;
+        TSQueue<OwnedMessage<T, Protocol>>& m_QMessagesIn;
         Message<T> m_MsgTemporaryIn;
-        Message<T> m_MsgTemporaryOut;
+
+        // Partial frame left over from the last read, empty (and unallocated) between frames
+        std::vector<uint8_t> m_RecvPending;
+
+        // Buffered reads only, see ReadSome
+        static constexpr size_t IdleReadSize = 256;
+        bool m_bRecvBusy = false;
+
+        // Messages being written by the current gather write and the buffers describing them
+        static constexpr size_t MaxBatchFrames = 64;
+        static constexpr size_t MaxIdleWriteStorage = 1024;
+        std::vector<Message<T>> m_WriteBatch;
+        std::vector<asio::const_buffer> m_WriteBuffers;
+
+        // Optional handler called on the asio thread before messages are queued
+        std::function<bool(Message<T>&)> m_FnIncomingHandler;
+        std::function<void()> m_FnCloseHandler;
 
         Owner m_OwnerType = Owner::Unkown;
 
@@ -314,5 +974,31 @@ namespace Fumbly {
         uint64_t m_HandshakeOut = 0;
         uint64_t m_HandshakeIn = 0;
         uint64_t m_HandshakeCheck = 0;
+        bool m_bValidated = false;
+
+        // Timeouts are driven by the owner's per io thread wheel, no wheel means no timeouts
+        TimerWheel* m_pTimerWheel = nullptr;
+        TimeoutSettings m_Timeouts;
+        TimerNode m_TimerTimeout;
+        TimerNode m_TimerHeartbeat;
+        bool m_bSentSinceHeartbeat = false;
+        std::atomic<size_t> m_nOutgoing = 0;
+
+        // Streams, only touched on the asio thread apart from the id counter
+        FrameSettings m_Frames;
+        std::unordered_map<uint32_t, IncomingStream> m_StreamsIn;
+        std::function<void(const StreamChunk<T>&)> m_FnStreamHandler;
+        ChunkFrame m_ChunkOut{};
+        std::atomic<uint32_t> m_StreamCounter = 1;
+
+        // Outbound queues by Priority and the lane of each message type (owned by the client/server)
+        std::array<Lane, PriorityCount> m_Lanes;
+        const std::unordered_map<T, Priority>* m_pPriorities = nullptr;
+        bool m_bWriting = false;
+
+#if defined(FUMBLY_HAS_CAPTURE)
+        // Optional traffic capture owned by the server
+        CaptureLog* m_pCapture = nullptr;
+#endif
     };
 }
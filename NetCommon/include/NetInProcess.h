@@ -0,0 +1,277 @@
+#pragma once
+
+#include "NetCommon.h"
+
+namespace Fumbly {
+    // Transport between two ends in the same process with no kernel object in between. Both ends share one link, a
+    // byte queue per direction under one mutex. A write that finds the peer's read waiting copies straight from the
+    // sender's buffers into the reader's (a message body goes from the sent message into the received one in a single
+    // copy), otherwise the bytes wait in the queue, bounded by the link capacity, and a write into a full queue is held
+    // until the reader makes room. The end that moves data completes the peer's waiting op itself by posting it to the
+    // peer's io context, so there is no waiter thread and no syscall beyond that post.
+    // Use it as the Protocol of Connection/ClientInterface/ServerInterface, ends are joined with connect_pair:
+    //     ServerInterface<T, InProcessProtocol> server{ServerSettings{}};
+    //     ClientInterface<T, InProcessProtocol> client;
+    //     server.ConnectSocketPair(client);
+    class InProcessProtocol
+    {
+    public:
+        class endpoint
+        {
+        public:
+            friend std::ostream& operator<<(std::ostream& os, const endpoint&)
+            {
+                os << "inproc";
+                return os;
+            }
+        };
+
+        // Ends are joined explicitly, there is nothing to listen on
+        class acceptor
+        {
+        public:
+            acceptor(asio::io_context&) {}
+            bool is_open() const { return false; }
+
+            template<typename Handler>
+            void async_accept(Handler&&) {}
+        };
+
+        class socket
+        {
+        public:
+            using executor_type = asio::io_context::executor_type;
+
+            // Bytes each direction queues while its reader is busy
+            static constexpr size_t DefaultCapacity = 1 << 20;
+
+            socket(asio::io_context& asioContext) : m_Executor(asioContext.get_executor()) {}
+            ~socket() { close(); }
+
+            socket(socket&& other) = default;
+            socket& operator=(socket&& other)
+            {
+                close();
+                m_Executor = other.m_Executor;
+                m_Link = std::move(other.m_Link);
+                m_nSide = other.m_nSide;
+                return *this;
+            }
+
+            // Joins two sockets into one link, found by argument dependent lookup like asio::local::connect_pair
+            friend void connect_pair(socket& first, socket& second, size_t capacity = DefaultCapacity)
+            {
+                first.close();
+                second.close();
+                auto link = std::make_shared<Link>(capacity);
+                first.m_Link = link;
+                first.m_nSide = 0;
+                second.m_Link = link;
+                second.m_nSide = 1;
+            }
+
+            executor_type get_executor() { return m_Executor; }
+
+            bool is_open() const { return m_Link && !m_Link->bClosed; }
+
+            // Aborts this end's waiting ops, the peer reads what is left and then sees the end of the stream
+            void close()
+            {
+                if(!m_Link)
+                    return;
+
+                std::scoped_lock lock(m_Link->Mux);
+                if(m_Link->bClosed.exchange(true))
+                    return;
+
+                Pipe& in = m_Link->Pipes[1 - m_nSide];
+                Pipe& out = m_Link->Pipes[m_nSide];
+                Complete(in.ParkedRead, asio::error::operation_aborted, 0);
+                Complete(out.ParkedWrite, asio::error::operation_aborted, 0);
+                Complete(out.ParkedRead, asio::error::eof, 0);
+                Complete(in.ParkedWrite, asio::error::broken_pipe, 0);
+            }
+
+            void close(asio::error_code&) { close(); }
+
+            endpoint remote_endpoint(asio::error_code&) const
+            {
+                return endpoint();
+            }
+
+            template<typename MutableBufferSequence, typename ReadHandler>
+            void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+            {
+                Start(true, asio::buffer_sequence_begin(buffers), asio::buffer_sequence_end(buffers), std::forward<ReadHandler>(handler));
+            }
+
+            template<typename ConstBufferSequence, typename WriteHandler>
+            void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+            {
+                Start(false, asio::buffer_sequence_begin(buffers), asio::buffer_sequence_end(buffers), std::forward<WriteHandler>(handler));
+            }
+
+        private:
+            // Type erased move only completion handler, posted to the io context of the end that started the op
+            struct Completion
+            {
+                virtual ~Completion() = default;
+                virtual void Post(asio::error_code ec, size_t length) = 0;
+            };
+
+            template<typename Handler>
+            struct CompletionImpl : Completion
+            {
+                CompletionImpl(executor_type executor, Handler&& h) : Executor(executor), HandlerFn(std::move(h)) {}
+                void Post(asio::error_code ec, size_t length) override
+                {
+                    asio::post(Executor, [h = std::move(HandlerFn), ec, length]() mutable { h(ec, length); });
+                }
+                executor_type Executor;
+                Handler HandlerFn;
+            };
+
+            // An op waiting for data (read) or space (write)
+            struct PendingOp
+            {
+                std::vector<asio::mutable_buffer> Buffers;
+                std::unique_ptr<Completion> Handler;
+            };
+
+            // One direction of the link, written by one end and read by the other
+            struct Pipe
+            {
+                std::vector<uint8_t> Bytes;
+                size_t nReadPos = 0;
+                PendingOp ParkedRead;
+                PendingOp ParkedWrite;
+
+                size_t Queued() const { return Bytes.size() - nReadPos; }
+            };
+
+            // Pipes[i] carries what end i writes, at most one read and one write per end are outstanding
+            struct Link
+            {
+                Link(size_t capacity) : Capacity(capacity) {}
+
+                std::mutex Mux;
+                const size_t Capacity;
+                Pipe Pipes[2];
+                std::atomic<bool> bClosed = false;
+            };
+
+            // A queue grown past this by a burst is given back once the reader drains it
+            static constexpr size_t MaxIdleQueue = 16 << 10;
+
+            static void Complete(PendingOp& op, asio::error_code ec, size_t length)
+            {
+                if(!op.Handler)
+                    return;
+                op.Handler->Post(ec, length);
+                op = PendingOp();
+            }
+
+            template<typename Iterator, typename Handler>
+            void Start(bool read, Iterator begin, Iterator end, Handler&& handler)
+            {
+                PendingOp op;
+                for(auto it = begin; it != end; ++it)
+                {
+                    // Write buffers are const, they are only ever read from
+                    asio::const_buffer b(*it);
+                    op.Buffers.emplace_back(const_cast<void*>(b.data()), b.size());
+                }
+                op.Handler = std::make_unique<CompletionImpl<std::decay_t<Handler>>>(m_Executor, std::move(handler));
+
+                if(!m_Link)
+                {
+                    Complete(op, asio::error::bad_descriptor, 0);
+                    return;
+                }
+
+                std::scoped_lock lock(m_Link->Mux);
+                if(read)
+                    Read(*m_Link, m_Link->Pipes[1 - m_nSide], std::move(op));
+                else
+                    Write(*m_Link, m_Link->Pipes[m_nSide], std::move(op));
+            }
+
+            // Link mutex is held by the callers of Read and Write
+            static void Read(Link& link, Pipe& pipe, PendingOp op)
+            {
+                if(pipe.Queued() == 0)
+                {
+                    if(link.bClosed)
+                        Complete(op, asio::error::eof, 0);
+                    else if(asio::buffer_size(op.Buffers) == 0)
+                        Complete(op, asio::error_code(), 0);
+                    else
+                        pipe.ParkedRead = std::move(op);
+                    return;
+                }
+
+                size_t moved = asio::buffer_copy(op.Buffers, asio::const_buffer(pipe.Bytes.data() + pipe.nReadPos, pipe.Queued()));
+                pipe.nReadPos += moved;
+                if(pipe.Queued() == 0)
+                {
+                    if(pipe.Bytes.capacity() > MaxIdleQueue)
+                        std::vector<uint8_t>().swap(pipe.Bytes);
+                    pipe.Bytes.clear();
+                    pipe.nReadPos = 0;
+                }
+                Complete(op, asio::error_code(), moved);
+
+                // Room was made for a write held back by a full queue
+                if(pipe.ParkedWrite.Handler)
+                    Write(link, pipe, std::move(pipe.ParkedWrite));
+            }
+
+            static void Write(Link& link, Pipe& pipe, PendingOp op)
+            {
+                if(link.bClosed)
+                {
+                    Complete(op, asio::error::broken_pipe, 0);
+                    return;
+                }
+                if(asio::buffer_size(op.Buffers) == 0)
+                {
+                    Complete(op, asio::error_code(), 0);
+                    return;
+                }
+
+                // The reader waits on an empty queue, hand the bytes straight to it
+                if(pipe.ParkedRead.Handler)
+                {
+                    size_t moved = asio::buffer_copy(pipe.ParkedRead.Buffers, op.Buffers);
+                    Complete(pipe.ParkedRead, asio::error_code(), moved);
+                    Complete(op, asio::error_code(), moved);
+                    return;
+                }
+
+                size_t nSpace = link.Capacity - pipe.Queued();
+                if(nSpace == 0)
+                {
+                    pipe.ParkedWrite = std::move(op);
+                    return;
+                }
+
+                // Drop the bytes already read before appending
+                if(pipe.nReadPos > 0)
+                {
+                    pipe.Bytes.erase(pipe.Bytes.begin(), pipe.Bytes.begin() + pipe.nReadPos);
+                    pipe.nReadPos = 0;
+                }
+                size_t nOld = pipe.Bytes.size();
+                size_t nAppend = std::min(nSpace, asio::buffer_size(op.Buffers));
+                pipe.Bytes.resize(nOld + nAppend);
+                size_t moved = asio::buffer_copy(asio::buffer(pipe.Bytes.data() + nOld, nAppend), op.Buffers);
+                Complete(op, asio::error_code(), moved);
+            }
+
+        private:
+            executor_type m_Executor;
+            std::shared_ptr<Link> m_Link;
+            uint32_t m_nSide = 0;
+        };
+    };
+}
@@ -0,0 +1,466 @@
+#pragma once
+
+// Expects asio to be included first (see NetCommon.h)
+#include <atomic>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+// Compile time level stripping, anything below FUMBLY_LOG_LEVEL compiles to nothing
+#define FUMBLY_LOG_LEVEL_TRACE 0
+#define FUMBLY_LOG_LEVEL_INFO 1
+#define FUMBLY_LOG_LEVEL_WARN 2
+#define FUMBLY_LOG_LEVEL_ERROR 3
+#define FUMBLY_LOG_LEVEL_OFF 4
+
+#ifndef FUMBLY_LOG_LEVEL
+#define FUMBLY_LOG_LEVEL FUMBLY_LOG_LEVEL_INFO
+#endif
+
+#if FUMBLY_LOG_LEVEL <= FUMBLY_LOG_LEVEL_TRACE
+#define FUMBLY_LOG_TRACE(...) ::Fumbly::Logger::Get().Write(::Fumbly::LogLevel::Trace, __VA_ARGS__)
+#else
+#define FUMBLY_LOG_TRACE(...) (void)0
+#endif
+
+#if FUMBLY_LOG_LEVEL <= FUMBLY_LOG_LEVEL_INFO
+#define FUMBLY_LOG_INFO(...) ::Fumbly::Logger::Get().Write(::Fumbly::LogLevel::Info, __VA_ARGS__)
+#else
+#define FUMBLY_LOG_INFO(...) (void)0
+#endif
+
+#if FUMBLY_LOG_LEVEL <= FUMBLY_LOG_LEVEL_WARN
+#define FUMBLY_LOG_WARN(...) ::Fumbly::Logger::Get().Write(::Fumbly::LogLevel::Warn, __VA_ARGS__)
+#else
+#define FUMBLY_LOG_WARN(...) (void)0
+#endif
+
+#if FUMBLY_LOG_LEVEL <= FUMBLY_LOG_LEVEL_ERROR
+#define FUMBLY_LOG_ERROR(...) ::Fumbly::Logger::Get().Write(::Fumbly::LogLevel::Error, __VA_ARGS__)
+#else
+#define FUMBLY_LOG_ERROR(...) (void)0
+#endif
+
+namespace Fumbly {
+    enum class LogLevel : uint8_t
+    {
+        Trace,
+        Info,
+        Warn,
+        Error
+    };
+
+    // Text that lives for the whole program (a string literal). Only its address goes into the entry, the writer
+    // reads the text later, i.e FUMBLY_LOG_INFO(LogLiteral{"[SERVER] Started"})
+    struct LogLiteral
+    {
+        const char* Text;
+    };
+
+    // Asynchronous logger. Callers only copy their arguments raw into a slot of a lock free ring,
+    // a background thread formats them, adds the timestamp/level and does the actual (blocking) write
+    class Logger
+    {
+    public:
+        static constexpr size_t RingSize = 4096;
+        static constexpr size_t MaxEntryLength = 240;
+        static constexpr std::chrono::milliseconds LingerInterval{5};
+
+        static Logger& Get()
+        {
+            static Logger logger;
+            return logger;
+        }
+
+        Logger(const Logger& other) = delete;
+        void operator=(const Logger& other) = delete;
+
+        ~Logger()
+        {
+            {
+                std::scoped_lock lock(m_MuxWake);
+                m_Running = false;
+            }
+            m_CvWake.notify_one();
+            if(m_ThrWriter.joinable())
+                m_ThrWriter.join();
+        }
+
+    public:
+        // Never blocks, if the ring is full the entry is dropped and counted. Text is copied into the entry (char
+        // arrays up to their first nul), wrap literals in LogLiteral to store only their address
+        template<typename... Args>
+        void Write(LogLevel level, const Args&... args)
+        {
+            if(m_bSynchronous.load(std::memory_order_relaxed))
+            {
+                Entry entry;
+                Fill(entry, level, args...);
+                std::scoped_lock lock(m_MuxSynchronous);
+                WriteEntry(entry);
+                return;
+            }
+
+            Entry* entry = Claim();
+            if(!entry)
+            {
+                m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Fill(*entry, level, args...);
+            Publish(entry);
+        }
+
+        // Destination of the background writer, defaults to stdout
+        void SetOutput(FILE* file)
+        {
+            m_Output.store(file);
+        }
+
+        // Format and write every line on the calling thread, as the old std::cout logging did. A baseline for
+        // NetBench log, or a way to keep the last lines of a crashing process. Lines already queued still go out
+        // from the writer thread
+        void SetSynchronous(bool bSynchronous)
+        {
+            m_bSynchronous.store(bSynchronous);
+        }
+
+        uint64_t DroppedCount() const
+        {
+            return m_Dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Entry
+        {
+            std::atomic<size_t> Sequence{0};
+            LogLevel Level = LogLevel::Info;
+            std::chrono::system_clock::time_point Time{};
+            uint16_t Length = 0;
+            uint8_t Args[MaxEntryLength];
+        };
+
+        // Each argument is a type byte followed by its raw value
+        enum class ArgType : uint8_t
+        {
+            Literal,
+            Text,
+            Signed,
+            Unsigned,
+            ErrorCode,
+            Endpoint
+        };
+
+        struct PackedErrorCode
+        {
+            int Value;
+            const std::error_category* Category;
+        };
+
+        struct PackedEndpoint
+        {
+            uint8_t Bytes[16];
+            uint16_t Port;
+            bool bV6;
+        };
+
+        Logger()
+        {
+            for(size_t i = 0; i < RingSize; i++)
+                m_Ring[i].Sequence.store(i, std::memory_order_relaxed);
+
+            m_ThrWriter = std::thread([this]() { WriterLoop(); });
+        }
+
+        // Bounded multi producer ring (Vyukov), returns nullptr when full
+        Entry* Claim()
+        {
+            size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+            while(true)
+            {
+                Entry& entry = m_Ring[pos & (RingSize - 1)];
+                size_t seq = entry.Sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0)
+                {
+                    if(m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        return &entry;
+                }
+                else if(diff < 0)
+                {
+                    return nullptr;
+                }
+                else
+                {
+                    pos = m_EnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        template<typename... Args>
+        static void Fill(Entry& entry, LogLevel level, const Args&... args)
+        {
+            entry.Level = level;
+            entry.Time = std::chrono::system_clock::now();
+            entry.Length = 0;
+            (Append(entry, args), ...);
+        }
+
+        void Publish(Entry* entry)
+        {
+            size_t pos = entry->Sequence.load(std::memory_order_relaxed);
+            entry->Sequence.store(pos + 1, std::memory_order_release);
+
+            // Pairs with the fence in WriterLoop, either the writer sees this entry before parking or we see it parked.
+            // A lingering writer is only woken every quarter ring, it comes back by itself soon enough
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_bWriterParked.load(std::memory_order_relaxed) &&
+                (!m_bWriterLingering.load(std::memory_order_relaxed) || (pos & (RingSize / 4 - 1)) == 0))
+            {
+                {
+                    std::scoped_lock lock(m_MuxWake);
+                }
+                m_CvWake.notify_one();
+            }
+        }
+
+        bool Pending() const
+        {
+            return m_Ring[m_DequeuePos & (RingSize - 1)].Sequence.load(std::memory_order_acquire) == m_DequeuePos + 1;
+        }
+
+        size_t QueuedCount() const
+        {
+            return m_EnqueuePos.load(std::memory_order_relaxed) - m_DequeuePos;
+        }
+
+        // Single consumer, drains everything published. After writing it lingers for LingerInterval so a steady
+        // trickle of lines is written in batches instead of waking the writer (a context switch) for every line,
+        // once a linger finds nothing new it parks until the next Publish
+        void WriterLoop()
+        {
+            while(true)
+            {
+                bool running = m_Running.load();
+                size_t nWritten = 0;
+
+                while(Pending())
+                {
+                    Entry& entry = m_Ring[m_DequeuePos & (RingSize - 1)];
+
+                    WriteEntry(entry);
+                    entry.Sequence.store(m_DequeuePos + RingSize, std::memory_order_release);
+                    m_DequeuePos++;
+                    nWritten++;
+                }
+
+                FILE* out = m_Output.load();
+                if(nWritten > 0)
+                    fflush(out);
+
+                // Final pass above has flushed anything logged before shutdown
+                if(!running)
+                    break;
+
+                bool bLinger = nWritten > 0;
+                std::unique_lock<std::mutex> ul(m_MuxWake);
+                m_bWriterLingering.store(bLinger, std::memory_order_relaxed);
+                m_bWriterParked.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(bLinger)
+                    m_CvWake.wait_for(ul, LingerInterval, [this]() { return QueuedCount() >= RingSize / 4 || !m_Running; });
+                else
+                    m_CvWake.wait(ul, [this]() { return Pending() || !m_Running; });
+                m_bWriterParked.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        void WriteEntry(const Entry& entry)
+        {
+            static constexpr const char* levelNames[] = {"TRACE", "INFO", "WARN", "ERROR"};
+
+            FILE* out = m_Output.load();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(entry.Time.time_since_epoch()).count();
+            fprintf(out, "%lld.%03lld [%s] ", (long long)(ms / 1000), (long long)(ms % 1000), levelNames[(int)entry.Level]);
+
+            const uint8_t* pArg = entry.Args;
+            const uint8_t* pEnd = entry.Args + entry.Length;
+            while(pArg < pEnd)
+            {
+                ArgType type = static_cast<ArgType>(*pArg++);
+                switch(type)
+                {
+                    case ArgType::Literal:
+                    {
+                        const char* text = Unpack<const char*>(pArg);
+                        fputs(text, out);
+                        break;
+                    }
+                    case ArgType::Text:
+                    {
+                        uint8_t n = *pArg++;
+                        fwrite(pArg, 1, n, out);
+                        pArg += n;
+                        break;
+                    }
+                    case ArgType::Signed:
+                        fprintf(out, "%lld", (long long)Unpack<int64_t>(pArg));
+                        break;
+                    case ArgType::Unsigned:
+                        fprintf(out, "%llu", (unsigned long long)Unpack<uint64_t>(pArg));
+                        break;
+                    case ArgType::ErrorCode:
+                    {
+                        PackedErrorCode packed = Unpack<PackedErrorCode>(pArg);
+                        fputs(packed.Category->message(packed.Value).c_str(), out);
+                        break;
+                    }
+                    case ArgType::Endpoint:
+                    {
+                        PackedEndpoint packed = Unpack<PackedEndpoint>(pArg);
+                        asio::ip::address address;
+                        if(packed.bV6)
+                        {
+                            asio::ip::address_v6::bytes_type bytes;
+                            memcpy(bytes.data(), packed.Bytes, bytes.size());
+                            address = asio::ip::address_v6(bytes);
+                        }
+                        else
+                        {
+                            asio::ip::address_v4::bytes_type bytes;
+                            memcpy(bytes.data(), packed.Bytes, bytes.size());
+                            address = asio::ip::address_v4(bytes);
+                        }
+                        fprintf(out, "%s:%u", address.to_string().c_str(), (unsigned)packed.Port);
+                        break;
+                    }
+                }
+            }
+            fputc('\n', out);
+        }
+
+        template<typename V>
+        static V Unpack(const uint8_t*& pArg)
+        {
+            V value;
+            memcpy(&value, pArg, sizeof(V));
+            pArg += sizeof(V);
+            return value;
+        }
+
+        // Arguments that do not fit in the entry are left out
+        template<typename V>
+        static void Pack(Entry& entry, ArgType type, const V& value)
+        {
+            if(entry.Length + 1 + sizeof(V) > MaxEntryLength)
+                return;
+            entry.Args[entry.Length] = static_cast<uint8_t>(type);
+            memcpy(entry.Args + entry.Length + 1, &value, sizeof(V));
+            entry.Length += static_cast<uint16_t>(1 + sizeof(V));
+        }
+
+        // Copied text is truncated to what is left of the entry
+        static void PackText(Entry& entry, std::string_view text)
+        {
+            if(entry.Length + size_t(2) > MaxEntryLength)
+                return;
+            size_t n = std::min({text.size(), MaxEntryLength - entry.Length - 2, size_t(255)});
+            entry.Args[entry.Length] = static_cast<uint8_t>(ArgType::Text);
+            entry.Args[entry.Length + 1] = static_cast<uint8_t>(n);
+            memcpy(entry.Args + entry.Length + 2, text.data(), n);
+            entry.Length += static_cast<uint16_t>(2 + n);
+        }
+
+        template<typename DataType>
+        static void Append(Entry& entry, const DataType& data)
+        {
+            if constexpr (std::is_same_v<DataType, LogLiteral>)
+            {
+                Pack(entry, ArgType::Literal, data.Text);
+            }
+            else if constexpr (std::is_array_v<DataType> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<DataType>>, char>)
+            {
+                // May be a buffer on the caller's stack, never read past its end
+                size_t nLength = 0;
+                while(nLength < std::extent_v<DataType> && data[nLength] != '\0')
+                    nLength++;
+                PackText(entry, std::string_view(data, nLength));
+            }
+            else if constexpr (std::is_same_v<DataType, const char*> || std::is_same_v<DataType, char*>)
+            {
+                PackText(entry, data ? std::string_view(data) : std::string_view("(null)"));
+            }
+            else if constexpr (std::is_convertible_v<const DataType&, std::string_view>)
+            {
+                PackText(entry, std::string_view(data));
+            }
+            else if constexpr (std::is_integral_v<DataType> && std::is_signed_v<DataType>)
+            {
+                Pack(entry, ArgType::Signed, static_cast<int64_t>(data));
+            }
+            else if constexpr (std::is_integral_v<DataType>)
+            {
+                Pack(entry, ArgType::Unsigned, static_cast<uint64_t>(data));
+            }
+            else if constexpr (std::is_same_v<DataType, std::error_code>)
+            {
+                // Categories are static objects, the message is looked up by the writer
+                Pack(entry, ArgType::ErrorCode, PackedErrorCode{data.value(), &data.category()});
+            }
+            else if constexpr (std::is_same_v<DataType, asio::ip::tcp::endpoint>)
+            {
+                PackedEndpoint packed{};
+                packed.Port = data.port();
+                packed.bV6 = data.address().is_v6();
+                if(packed.bV6)
+                {
+                    auto bytes = data.address().to_v6().to_bytes();
+                    memcpy(packed.Bytes, bytes.data(), bytes.size());
+                }
+                else
+                {
+                    auto bytes = data.address().to_v4().to_bytes();
+                    memcpy(packed.Bytes, bytes.data(), bytes.size());
+                }
+                Pack(entry, ArgType::Endpoint, packed);
+            }
+            else
+            {
+                // Rare/complex types fall back to their ostream overload, formatted by the caller
+                std::ostringstream os;
+                os << data;
+                PackText(entry, os.str());
+            }
+        }
+
+    private:
+        std::array<Entry, RingSize> m_Ring;
+        alignas(64) std::atomic<size_t> m_EnqueuePos{0};
+        alignas(64) size_t m_DequeuePos = 0;
+
+        std::atomic<uint64_t> m_Dropped{0};
+        std::atomic<FILE*> m_Output{stdout};
+        std::atomic<bool> m_Running{true};
+
+        // Synchronous lines are written whole, one caller at a time
+        std::atomic<bool> m_bSynchronous{false};
+        std::mutex m_MuxSynchronous;
+
+        // Writer sleeps on the condition variable once the ring is empty, Publish only locks when it is parked
+        std::atomic<bool> m_bWriterParked{false};
+        std::atomic<bool> m_bWriterLingering{false};
+        std::mutex m_MuxWake;
+        std::condition_variable m_CvWake;
+
+        std::thread m_ThrWriter;
+    };
+}
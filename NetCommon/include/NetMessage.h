@@ -3,11 +3,37 @@
 #include "NetCommon.h"
 
 namespace Fumbly {
+    // Bits of MessageHeader::Flags used by the library itself, such frames never reach the incoming queue
+    struct MessageFlags
+    {
+        static constexpr uint32_t Heartbeat = 1 << 0;
+
+        // Body is a StreamChunkHeader followed by a piece of a larger payload (see Connection::SendStream)
+        static constexpr uint32_t StreamChunk = 1 << 1;
+    };
+
+    // Outbound priority classes, every connection keeps one queue per class (see FrameSettings::LaneWeights)
+    enum class Priority : uint8_t
+    {
+        // Small latency critical frames (heartbeats, acks), always written first
+        Control,
+        Realtime,
+        Normal,
+        Bulk
+    };
+    static constexpr size_t PriorityCount = 4;
+
     template <typename T>
     struct MessageHeader
     {
         T Id{};
         uint32_t Size = 0;
+
+        // Non zero when message is part of a request/response pair (see ClientInterface::Call)
+        uint32_t CorrelationID = 0;
+
+        // See MessageFlags
+        uint32_t Flags = 0;
     };
     
     template <typename T>
@@ -70,14 +96,15 @@ namespace Fumbly {
         }
     };
 
-	template<typename T>
+	// Protocol is the asio stream protocol the connection runs on (tcp, local::stream_protocol)
+	template<typename T, typename Protocol = asio::ip::tcp>
 	class Connection;
 
-	template<typename T>
+	template<typename T, typename Protocol = asio::ip::tcp>
 	struct OwnedMessage
 	{
         // Reference to connection in order to identify message
-		std::shared_ptr<Connection<T>> Remote = nullptr;
+		std::shared_ptr<Connection<T, Protocol>> Remote = nullptr;
 		Message<T> Msg;
 
 		friend std::ostream& operator<<(std::ostream& os, const OwnedMessage& msg)
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "NetCommon.h"
+#include "NetCapture.h"
+#include "NetClient.h"
+
+#if defined(FUMBLY_HAS_CAPTURE)
+#include <map>
+
+namespace Fumbly {
+    // Feeds the incoming side of a capture back into a server. Every captured connection gets its own client,
+    // created by connect (i.e [&](auto& client) { return client.Connect("127.0.0.1", 60000); } or server.ConnectSocketPair(client)),
+    // and its recorded frames are sent in timestamp order. speed 1.0 keeps recorded timing, 0 sends as fast as possible.
+    // Elapsed covers queueing the frames, measure delivery on the server side
+    template<typename T, typename Protocol = asio::ip::tcp>
+    class CaptureReplay
+    {
+    public:
+        struct Result
+        {
+            size_t nConnections = 0;
+            size_t nFrames = 0;
+            uint64_t nBytes = 0;
+            std::chrono::nanoseconds Elapsed{0};
+        };
+
+        template<typename ConnectFn>
+        static Result Run(const std::string& path, ConnectFn&& connect, double speed = 1.0,
+            std::chrono::milliseconds settle = std::chrono::milliseconds(5000))
+        {
+            CaptureReader reader(path);
+
+            // Gather incoming frames in time order, clients are created in order of first appearance
+            std::multimap<uint64_t, CaptureReader::Frame> frames;
+            std::map<uint32_t, std::unique_ptr<ClientInterface<T, Protocol>>> clients;
+            CaptureReader::Frame frame;
+            while(reader.Next(frame))
+            {
+                if(frame.Record->Direction != CaptureDirection::In)
+                    continue;
+                if(frame.Record->HeaderSize != sizeof(MessageHeader<T>))
+                    throw std::runtime_error("capture was recorded with a different message header");
+
+                frames.emplace(frame.Record->Timestamp, frame);
+                auto& client = clients[frame.Record->ConnectionID];
+                if(!client)
+                {
+                    client = std::make_unique<ClientInterface<T, Protocol>>();
+                    if(!connect(*client))
+                        throw std::runtime_error("replay client failed to connect");
+                }
+            }
+
+            // Give the handshakes time to complete before traffic starts
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+            Result result;
+            result.nConnections = clients.size();
+            auto start = std::chrono::steady_clock::now();
+            uint64_t firstTimestamp = frames.empty() ? 0 : frames.begin()->first;
+            for(auto& [timestamp, f] : frames)
+            {
+                if(speed > 0.0)
+                {
+                    auto due = start + std::chrono::nanoseconds(uint64_t((timestamp - firstTimestamp) / speed));
+                    std::this_thread::sleep_until(due);
+                }
+
+                Message<T> msg;
+                memcpy(&msg.Header, f.Header, sizeof(MessageHeader<T>));
+                msg.Body.assign(f.Body, f.Body + f.Record->BodySize);
+                clients[f.Record->ConnectionID]->Send(msg);
+
+                result.nFrames++;
+                result.nBytes += sizeof(MessageHeader<T>) + f.Record->BodySize;
+            }
+            result.Elapsed = std::chrono::steady_clock::now() - start;
+
+            // Clients drop unsent messages on disconnect, let the write queues flush first
+            auto deadline = std::chrono::steady_clock::now() + settle;
+            for(auto& [id, client] : clients)
+            {
+                while(client->IsConnected() && client->OutgoingCount() > 0 && std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return result;
+        }
+    };
+}
+#endif
@@ -6,16 +6,101 @@
 #include "TSQueue.h"
 #include "NetMessage.h"
 #include "NetConnection.h"
+#include "NetClient.h"
 
 namespace Fumbly {
-    template<typename T>
+#ifdef SO_REUSEPORT
+    // Lets several acceptors bind the same port, the kernel load balances incoming connections between them
+    using ReusePortOption = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+    struct ServerSettings
+    {
+        // Each io thread runs its own asio context, connections stay on the thread that accepted them
+        uint32_t nIOThreads = 1;
+
+        // Give every io thread its own SO_REUSEPORT acceptor, otherwise only a single io thread is used
+        bool bReusePort = false;
+
+        // Pending connection queue length passed to listen()
+        int nListenBacklog = asio::socket_base::max_listen_connections;
+
+        // Handshake/idle/heartbeat timeouts applied to every connection
+        TimeoutSettings Timeouts;
+
+        // Max frame size enforced on every read and the chunking of streams
+        FrameSettings Frames;
+
+        // Resolution of the per io thread timer wheel driving the timeouts
+        std::chrono::milliseconds TimerTick{100};
+
+        // When set every frame sent or received is appended to this capture file (see NetCapture.h/NetReplay.h)
+        std::string CapturePath;
+    };
+
+    template<typename T, typename Protocol>
     class ServerInterface
     {
     public:
-        ServerInterface(uint16_t port) 
-            :m_AsioAcceptor(m_AsioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+        // Handler returns the response to a request, correlation id is copied over by the server
+        using RpcHandler = std::function<Message<T>(std::shared_ptr<Connection<T, Protocol>>, Message<T>&)>;
+
+    public:
+        // TCP only - listen on all ipv4 interfaces
+        template<typename P = Protocol, typename = std::enable_if_t<std::is_same_v<P, asio::ip::tcp>>>
+        ServerInterface(uint16_t port, const ServerSettings& settings = {})
+            :ServerInterface(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port), settings)
         {
+        }
 
+        // Listen on an endpoint of any protocol (i.e a unix domain socket path)
+        ServerInterface(const typename Protocol::endpoint& endpoint, const ServerSettings& settings = {})
+            :m_Timeouts(settings.Timeouts), m_Frames(settings.Frames)
+        {
+            OpenCapture(settings);
+
+            uint32_t nIOThreads = std::max<uint32_t>(1, settings.nIOThreads);
+#ifdef SO_REUSEPORT
+            bool bReusePort = settings.bReusePort && std::is_same_v<Protocol, asio::ip::tcp>;
+#else
+            bool bReusePort = false;
+#endif
+            // Without reuse port only one acceptor can own the port
+            if(!bReusePort)
+                nIOThreads = 1;
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+            // A socket file left behind by a previous run would make bind fail
+            if constexpr (std::is_same_v<Protocol, asio::local::stream_protocol>)
+                std::remove(endpoint.path().c_str());
+#endif
+
+            for(uint32_t i = 0; i < nIOThreads; i++)
+            {
+                auto io = std::make_unique<IOThread>(settings.TimerTick);
+                io->Acceptor.open(endpoint.protocol());
+                if constexpr (std::is_same_v<Protocol, asio::ip::tcp>)
+                {
+                    io->Acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+                    if(bReusePort)
+                        io->Acceptor.set_option(ReusePortOption(true));
+#endif
+                }
+                io->Acceptor.bind(endpoint);
+                io->Acceptor.listen(settings.nListenBacklog);
+                m_IOThreads.push_back(std::move(io));
+            }
+        }
+
+        // No listener, clients can only attach with AttachSocket or ConnectSocketPair
+        ServerInterface(const ServerSettings& settings)
+            :m_Timeouts(settings.Timeouts), m_Frames(settings.Frames)
+        {
+            OpenCapture(settings);
+
+            for(uint32_t i = 0; i < std::max<uint32_t>(1, settings.nIOThreads); i++)
+                m_IOThreads.push_back(std::make_unique<IOThread>(settings.TimerTick));
         }
 
         ~ServerInterface()
@@ -26,101 +111,240 @@ namespace Fumbly {
         bool Start() 
         {
             try {
-                // Prime work for server
-                WaitForClientConnection();
+                for(auto& io : m_IOThreads)
+                {
+                    // Prime work for server
+                    if(io->Acceptor.is_open())
+                        WaitForClientConnection(*io);
+                    io->Wheel.Start();
 
-                m_ThreadContext = std::thread([this](){m_AsioContext.run();});
+                    io->Thread = std::thread([ctx = &io->Context](){ctx->run();});
+                }
             } catch (std::exception& e) {
-                std::cerr << "[SERVER] Exeption: " << e.what() << "\n";
+                FUMBLY_LOG_ERROR("[SERVER] Exeption: ", e.what());
                 return false;
             }
 
-            std::cout << "[SERVER] Started!\n";
+            FUMBLY_LOG_INFO("[SERVER] Started! (", m_IOThreads.size(), " io threads)");
             return true;
         }
 
         bool Stop()
         {
             // Tell Asio to Stop
-            m_AsioContext.stop();
+            for(auto& io : m_IOThreads)
+                io->Context.stop();
 
             // Make sure all asio work is finished before exiting by waiting with join()
-            if(m_ThreadContext.joinable())
-                m_ThreadContext.join();
+            for(auto& io : m_IOThreads)
+            {
+                if(io->Thread.joinable())
+                    io->Thread.join();
+            }
 
-            std::cout << "[SERVER] Stopped!\n";
+            FUMBLY_LOG_INFO("[SERVER] Stopped!");
             return true;
         }
 
-        // ASYNC - Instruct asio to wait for connection
-        void WaitForClientConnection()
+    private:
+        // Asio context, acceptor and thread for one io thread
+        struct IOThread
+        {
+            IOThread(std::chrono::milliseconds tick) : Wheel(Context, tick) {}
+
+            asio::io_context Context;
+            typename Protocol::acceptor Acceptor{Context};
+            TimerWheel Wheel;
+            std::thread Thread;
+        };
+
+        // ASYNC - Instruct asio to wait for connection on an io thread, the connection is created and validated on the same thread
+        void WaitForClientConnection(IOThread& io)
         {
-            m_AsioAcceptor.async_accept([this](std::error_code ec, asio::ip::tcp::socket socket){
+            io.Acceptor.async_accept([this, &io](std::error_code ec, typename Protocol::socket socket){
                 if(!ec) {
-                    std::cout << "[SERVER] New Connection: "  << socket.remote_endpoint() << "\n";
-
-                    // Create connection between client and server
-                     std::shared_ptr<Connection<T>> newconn = std::make_shared<Connection<T>>(
-                         Connection<T>::Owner::Server, 
-                         m_AsioContext,
-                         std::move(socket),
-                         m_QMessagesIn
-                     );
-
-                    // Give user ability to deny connection
-                     if(OnClientConnect(newconn)) {
-                         m_DeqConnections.push_back(std::move(newconn));
-                         m_DeqConnections.back()->ConnectToClient(this, m_IDCounter++);
-                         std::cout << "[SERVER] client: " << m_DeqConnections.back()->GetID() << " Connection Approved\n";
-
-                     } else {
-                         std::cout << "[SERVER] remote endpoint: " << socket.remote_endpoint() << " Denied Connection \n";
-                     }
+                    OnAccepted(io, std::move(socket));
                 } else {
-                    std::cout << "[SERVER] New Connection Error: "  << ec.message() << "\n";
+                    FUMBLY_LOG_WARN("[SERVER] New Connection Error: ", ec);
                 }
 
                 //  Make sure server is always primed to listen for connections
-                WaitForClientConnection();
+                WaitForClientConnection(io);
+            });
+        }
+
+        void OpenCapture(const ServerSettings& settings)
+        {
+            if(!settings.CapturePath.empty())
+            {
+#if defined(FUMBLY_HAS_CAPTURE)
+                m_Capture = std::make_unique<CaptureLog>(settings.CapturePath);
+#else
+                FUMBLY_LOG_WARN("[SERVER] Traffic capture is not supported on this platform");
+#endif
+            }
+        }
+
+        // Whoever takes the client out of the list calls OnClientDisconnect, so it runs once per client and never
+        // under the lock
+        void RemoveClient(const std::shared_ptr<Connection<T, Protocol>>& client)
+        {
+            {
+                std::scoped_lock lock(m_MuxConnections);
+                auto it = std::find(m_DeqConnections.begin(), m_DeqConnections.end(), client);
+                if(it == m_DeqConnections.end())
+                    return;
+                m_DeqConnections.erase(it);
+            }
+            OnClientDisconnect(client);
+        }
+
+        // Must run on io's thread
+        void OnAccepted(IOThread& io, typename Protocol::socket socket)
+        {
+            // Endpoint is cached as the socket is moved into the connection below
+            asio::error_code ecEndpoint;
+            typename Protocol::endpoint endpoint = socket.remote_endpoint(ecEndpoint);
+            FUMBLY_LOG_INFO("[SERVER] New Connection: ", endpoint);
+
+            // Create connection between client and server
+             std::shared_ptr<Connection<T, Protocol>> newconn = std::make_shared<Connection<T, Protocol>>(
+                 Connection<T, Protocol>::Owner::Server, 
+                 io.Context,
+                 std::move(socket),
+                 m_QMessagesIn,
+                 &io.Wheel,
+                 m_Timeouts,
+                 m_Frames
+             );
+#if defined(FUMBLY_HAS_CAPTURE)
+            newconn->SetCapture(m_Capture.get());
+#endif
+            newconn->SetPriorities(&m_Priorities);
+            // Raw pointer, the handler is owned by the connection itself
+            Connection<T, Protocol>* pConnection = newconn.get();
+            newconn->SetStreamHandler([this, pConnection](const StreamChunk<T>& chunk) {
+                OnStreamChunk(pConnection->shared_from_this(), chunk);
+            });
+
+            // Removal is posted behind the completions of the operations the close aborted, the list keeps the
+            // connection alive until they have run
+            newconn->SetCloseHandler([this, &io, pConnection]() {
+                asio::post(io.Context, [this, weak = pConnection->weak_from_this()]() {
+                    if(auto client = weak.lock())
+                        RemoveClient(client);
+                });
             });
+
+            // Give user ability to deny connection
+             if(OnClientConnect(newconn)) {
+                 {
+                     std::scoped_lock lock(m_MuxConnections);
+                     m_DeqConnections.push_back(newconn);
+                 }
+                 newconn->ConnectToClient(this, m_IDCounter++);
+                 FUMBLY_LOG_INFO("[SERVER] client: ", newconn->GetID(), " Connection Approved");
+
+             } else {
+                 FUMBLY_LOG_INFO("[SERVER] remote endpoint: ", endpoint, " Denied Connection");
+             }
+        }
+
+    public:
+        // Hand the server a socket that is already connected (i.e a shared memory link). Factory is given the io context
+        // the connection will live on and must create the socket there, it then goes through the same validation as accepted sockets
+        template<typename SocketFactory>
+        bool AttachSocket(SocketFactory&& factory)
+        {
+            IOThread& io = *m_IOThreads[m_AttachCounter++ % m_IOThreads.size()];
+            try {
+                typename Protocol::socket socket = factory(io.Context);
+                asio::post(io.Context, [this, &io, socket = std::move(socket)]() mutable {
+                    OnAccepted(io, std::move(socket));
+                });
+            } catch (std::exception& e) {
+                FUMBLY_LOG_ERROR("[SERVER] Exeption: ", e.what());
+                return false;
+            }
+            return true;
         }
 
-        void MessageClient(std::shared_ptr<Connection<T>> client, const Message<T>& msg) 
+        // Joins a client in the same process through a pair of connected sockets, there is no listener and no path.
+        // With asio::local::stream_protocol it is a unix socket pair, still a kernel socket every message is copied
+        // through. With InProcessProtocol the pair never leaves the process (see NetInProcess.h)
+        bool ConnectSocketPair(ClientInterface<T, Protocol>& client)
+        {
+            typename Protocol::socket clientSocket(client.GetContext());
+            bool bAttached = AttachSocket([&clientSocket](asio::io_context& ctx) {
+                typename Protocol::socket serverSocket(ctx);
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+                using asio::local::connect_pair;
+#endif
+                connect_pair(serverSocket, clientSocket);
+                return serverSocket;
+            });
+            return bAttached && client.Connect(std::move(clientSocket));
+        }
+
+        void MessageClient(std::shared_ptr<Connection<T, Protocol>> client, const Message<T>& msg) 
         {
             if(client && client->IsConnected()) {
                 client->Send(msg);
             } else {
-                OnClientDisconnect(client);
-                client.reset(); 
-                m_DeqConnections.erase(std::remove(m_DeqConnections.begin(), m_DeqConnections.end(), cient), m_DeqConnections.end());
+                RemoveClient(client);
             }
         }
 
-        void MessageAllClients(const Message<T>& msg, std::shared_ptr<Connection<T>> pIgnoreClient)
+        // Send a payload of any size to client in chunks interleaved with its other traffic, returns the stream id or 0
+        uint32_t StreamClient(std::shared_ptr<Connection<T, Protocol>> client, T id, std::vector<uint8_t> payload, Priority priority = Priority::Bulk)
+        {
+            if(client && client->IsConnected())
+                return client->SendStream(id, std::move(payload), priority);
+
+            RemoveClient(client);
+            return 0;
+        }
+
+        void MessageAllClients(const Message<T>& msg, std::shared_ptr<Connection<T, Protocol>> pIgnoreClient)
         {
-            bool bInvalidClientsExist = false;
-            for(auto& client : m_DeqConnections)
+            // Closed clients the close notification has not removed yet, their callbacks run once the lock is released
+            std::vector<std::shared_ptr<Connection<T, Protocol>>> closed;
             {
-                // check if client is connected
-                if(client && client->IsConnected())
+                std::scoped_lock lock(m_MuxConnections);
+                for(auto& client : m_DeqConnections)
                 {
-                    if(client != pIgnoreClient)
-                        client->Send(msg);
-                } else {
-                    OnClientDisconnect(client);
-                    client.reset();
-                    bInvalidClientsExist = true;
+                    // check if client is connected
+                    if(client && client->IsConnected())
+                    {
+                        if(client != pIgnoreClient)
+                            client->Send(msg);
+                    } else {
+                        closed.push_back(std::move(client));
+                    }
+                }
+
+                // erase-remove all invalid connections
+                if(!closed.empty()) {
+                    m_DeqConnections.erase(
+                        std::remove(m_DeqConnections.begin(), m_DeqConnections.end(), nullptr), 
+                        m_DeqConnections.end());
                 }
             }
 
-            // erase-remove all invalid connections
-            if(bInvalidClientsExist) {
-                m_DeqConnections.erase(
-                    std::remove(m_DeqConnections.begin(), m_DeqConnections.end(), nullptr), 
-                    m_DeqConnections.end());
+            for(auto& client : closed)
+            {
+                if(client)
+                    OnClientDisconnect(client);
             }
         }
 
+        // Validated or still validating clients
+        size_t ConnectionCount()
+        {
+            std::scoped_lock lock(m_MuxConnections);
+            return m_DeqConnections.size();
+        }
+
         void Update(size_t nmaxMessages = -1, bool waitForMessage = false) 
         {
             // We don't need the server to occupy 100% of a cpu core
@@ -132,53 +356,97 @@ namespace Fumbly {
                 // Grab the front message
                 auto msg = m_QMessagesIn.PopFront();
 
-                // Pass to message handler
-                OnMessage(msg.Remote, msg.Msg);
+                // Requests with a registered handler are answered directly, everything else goes to message handler
+                auto handler = msg.Msg.Header.CorrelationID != 0 ? m_RpcHandlers.find(msg.Msg.Header.Id) : m_RpcHandlers.end();
+                if(handler != m_RpcHandlers.end())
+                {
+                    Message<T> response = handler->second(msg.Remote, msg.Msg);
+                    response.Header.CorrelationID = msg.Msg.Header.CorrelationID;
+                    MessageClient(msg.Remote, response);
+                }
+                else
+                {
+                    OnMessage(msg.Remote, msg.Msg);
+                }
 
                 nMessageCount++;
             }
         }
 
+        // Register handler for requests of message type id sent with ClientInterface::Call
+        void RegisterHandler(T id, RpcHandler handler)
+        {
+            m_RpcHandlers[id] = std::move(handler);
+        }
+
+        // Outbound lane for messages of type id sent to any client, must be set before Start
+        void SetPriority(T id, Priority priority)
+        {
+            m_Priorities[id] = priority;
+        }
+
     public:
         // Called after client is validated
-        virtual void OnClientValidated(std::shared_ptr<Connection<T>> client)
+        virtual void OnClientValidated(std::shared_ptr<Connection<T, Protocol>> client)
         {
 
         }
     protected:
         // Return if valid client
-        virtual bool OnClientConnect(std::shared_ptr<Connection<T>> client)
+        virtual bool OnClientConnect(std::shared_ptr<Connection<T, Protocol>> client)
         {
             return false;
         }
 
-        virtual void OnClientDisconnect(std::shared_ptr<Connection<T>> client)
+        // Called once per approved client after it closed, on its io thread when the close notification removes it
+        virtual void OnClientDisconnect(std::shared_ptr<Connection<T, Protocol>> client)
         {
 
         }
 
         // Main message callback
-        virtual void OnMessage(std::shared_ptr<Connection<T>> client, Message<T> msg)
+        virtual void OnMessage(std::shared_ptr<Connection<T, Protocol>> client, Message<T> msg)
+        {
+
+        }
+
+        // Called on the io thread for every chunk of a stream sent by a client (chunk data is only valid during the call),
+        // a StreamFileSink can be fed from here to write streams to disk
+        virtual void OnStreamChunk(std::shared_ptr<Connection<T, Protocol>> client, const StreamChunk<T>& chunk)
         {
 
         }
     
     protected:
+#if defined(FUMBLY_HAS_CAPTURE)
+        // Declared before the io threads so it outlives every connection writing to it
+        std::unique_ptr<CaptureLog> m_Capture;
+#endif
+
+        // One asio context/acceptor/thread per io thread, declared first so connections and queued messages are destroyed before their context
+        std::vector<std::unique_ptr<IOThread>> m_IOThreads;
+
         // Thread safe queue of incoming messages
-        TSQueue<OwnedMessage<T>> m_QMessagesIn;
+        TSQueue<OwnedMessage<T, Protocol>> m_QMessagesIn;
 
-        // Container of all active validated connections
-        std::deque<std::shared_ptr<Connection<T>>> m_DeqConnections;
+        // Container of all active validated connections, io threads add to it while accepting
+        std::deque<std::shared_ptr<Connection<T, Protocol>>> m_DeqConnections;
+        std::mutex m_MuxConnections;
 
-        // Server ASIO context
-        asio::io_context m_AsioContext;
-        std::thread m_ThreadContext;
+        TimeoutSettings m_Timeouts;
+        FrameSettings m_Frames;
 
-        // Asio acceptor that handles client sockets
-        asio::ip::tcp::acceptor m_AsioAcceptor;
+        // Round robin of attached connections over io threads
+        std::atomic<uint32_t> m_AttachCounter = 0;
 
         // Clients will have a global ID;
-        uint32_t m_IDCounter = 10000;
+        std::atomic<uint32_t> m_IDCounter = 10000;
+
+        // Request handlers by message type
+        std::unordered_map<T, RpcHandler> m_RpcHandlers;
+
+        // Outbound lane by message type, shared read only by all connections
+        std::unordered_map<T, Priority> m_Priorities;
     };
 }
 
@@ -0,0 +1,461 @@
+#pragma once
+
+#include "NetCommon.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <condition_variable>
+
+namespace Fumbly {
+    // Same host transport over a pair of single producer/single consumer byte rings in a shared memory segment.
+    // Frames are copied straight from the message into the mapped ring and read straight back out, there is no
+    // kernel involvement unless a side runs dry and has to sleep: readers/writers spin for a bounded time first,
+    // then park on a futex in the segment that the peer only wakes when it sees someone sleeping.
+    // Latency: a parked op costs two thread switches per direction (the futex wakes the waiter thread, which posts
+    // to the io thread) where a socket costs one epoll wakeup. With a spare core the spin catches the peer's answer
+    // before parking, on a single core nothing can be caught that way and a round trip is slower than tcp loopback
+    // (28-45us against 20-34us measured); the rings still win on throughput.
+    // Use it as the Protocol of Connection/ClientInterface/ServerInterface, links are point to point:
+    //     server.AttachSocket([](asio::io_context& ctx) { return SharedMemoryProtocol::socket::Create(ctx, "sim-link"); });
+    //     client.Connect(SharedMemoryProtocol::socket::Open(client.GetContext(), "sim-link"));
+    class SharedMemoryProtocol
+    {
+    public:
+        class endpoint
+        {
+        public:
+            endpoint() = default;
+            endpoint(std::string name) : m_Name(std::move(name)) {}
+
+            const std::string& name() const { return m_Name; }
+
+            friend std::ostream& operator<<(std::ostream& os, const endpoint& ep)
+            {
+                os << "shm:" << ep.m_Name;
+                return os;
+            }
+        private:
+            std::string m_Name;
+        };
+
+        // Links are attached explicitly, there is nothing to listen on
+        class acceptor
+        {
+        public:
+            acceptor(asio::io_context&) {}
+            bool is_open() const { return false; }
+
+            template<typename Handler>
+            void async_accept(Handler&&) {}
+        };
+
+        class socket
+        {
+        public:
+            using executor_type = asio::io_context::executor_type;
+
+            // Bytes of each direction's ring, must be a power of two
+            static constexpr size_t DefaultCapacity = 1 << 20;
+
+            // Iterations spent polling the ring before parking on the futex
+            static constexpr uint32_t SpinCount = 4000;
+
+            socket(asio::io_context& asioContext) : m_Executor(asioContext.get_executor()) {}
+            ~socket() { close(); }
+
+            socket(socket&& other) = default;
+            socket& operator=(socket&& other)
+            {
+                close();
+                m_Executor = other.m_Executor;
+                m_Impl = std::move(other.m_Impl);
+                return *this;
+            }
+
+            // Create a new segment, the creator is the "server" side of the link
+            static socket Create(asio::io_context& asioContext, const std::string& name, size_t capacity = DefaultCapacity)
+            {
+                socket s(asioContext);
+                s.m_Impl = std::make_shared<Impl>(name, capacity, true);
+                return s;
+            }
+
+            // Map an existing segment created by the peer
+            static socket Open(asio::io_context& asioContext, const std::string& name)
+            {
+                socket s(asioContext);
+                s.m_Impl = std::make_shared<Impl>(name, 0, false);
+                return s;
+            }
+
+            executor_type get_executor() { return m_Executor; }
+
+            bool is_open() const { return m_Impl && !m_Impl->IsClosed(); }
+
+            void close()
+            {
+                if(m_Impl)
+                    m_Impl->Close();
+            }
+
+            void close(asio::error_code&) { close(); }
+
+            endpoint remote_endpoint(asio::error_code&) const
+            {
+                return m_Impl ? endpoint(m_Impl->Name()) : endpoint();
+            }
+
+            template<typename MutableBufferSequence, typename ReadHandler>
+            void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+            {
+                Start(true, asio::buffer_sequence_begin(buffers), asio::buffer_sequence_end(buffers), std::forward<ReadHandler>(handler));
+            }
+
+            template<typename ConstBufferSequence, typename WriteHandler>
+            void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+            {
+                Start(false, asio::buffer_sequence_begin(buffers), asio::buffer_sequence_end(buffers), std::forward<WriteHandler>(handler));
+            }
+
+        private:
+            // Type erased move only completion handler
+            struct Completion
+            {
+                virtual ~Completion() = default;
+                virtual void Post(executor_type executor, asio::error_code ec, size_t length) = 0;
+                virtual void Invoke(asio::error_code ec, size_t length) = 0;
+            };
+
+            template<typename Handler>
+            struct CompletionImpl : Completion
+            {
+                CompletionImpl(Handler&& h) : HandlerFn(std::move(h)) {}
+                void Post(executor_type executor, asio::error_code ec, size_t length) override
+                {
+                    asio::post(executor, [h = std::move(HandlerFn), ec, length]() mutable { h(ec, length); });
+                }
+                void Invoke(asio::error_code ec, size_t length) override
+                {
+                    Handler h = std::move(HandlerFn);
+                    h(ec, length);
+                }
+                Handler HandlerFn;
+            };
+
+            // An operation waiting for data (read) or space (write)
+            struct PendingOp
+            {
+                std::vector<asio::mutable_buffer> Buffers;
+                std::unique_ptr<Completion> Handler;
+            };
+
+            // Lives in the mapped segment, ring 0 carries creator -> opener, ring 1 opener -> creator
+            struct alignas(64) RingHeader
+            {
+                alignas(64) std::atomic<uint64_t> Head;
+                alignas(64) std::atomic<uint64_t> Tail;
+            };
+
+            struct SegmentHeader
+            {
+                uint64_t Capacity;
+                RingHeader Rings[2];
+
+                // Side i sleeps on Doorbell[i], the peer rings it after every change it makes
+                alignas(64) std::atomic<uint32_t> Doorbell[2];
+                std::atomic<uint32_t> Sleeping[2];
+                std::atomic<uint32_t> Closed;
+            };
+
+            class Impl
+            {
+            public:
+                Impl(const std::string& name, size_t capacity, bool create)
+                    :m_Name(name), m_bCreator(create)
+                {
+                    std::string path = "/fumbly-" + name;
+                    int fd = -1;
+                    if(create)
+                    {
+                        if(capacity == 0 || (capacity & (capacity - 1)) != 0)
+                            throw std::invalid_argument("shared memory ring capacity must be a power of two");
+
+                        shm_unlink(path.c_str());
+                        fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+                        m_MappedSize = sizeof(SegmentHeader) + 2 * capacity;
+                        if(fd >= 0 && ftruncate(fd, (off_t)m_MappedSize) != 0)
+                        {
+                            ::close(fd);
+                            fd = -1;
+                        }
+                    }
+                    else
+                    {
+                        fd = shm_open(path.c_str(), O_RDWR, 0600);
+                        struct stat st{};
+                        if(fd >= 0 && fstat(fd, &st) == 0)
+                            m_MappedSize = (size_t)st.st_size;
+                    }
+                    if(fd < 0)
+                        throw std::system_error(errno, std::generic_category(), "shm_open " + path);
+
+                    void* mapped = mmap(nullptr, m_MappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    ::close(fd);
+                    if(mapped == MAP_FAILED)
+                        throw std::system_error(errno, std::generic_category(), "mmap " + path);
+
+                    // Freshly truncated segment is zeroed, which is a valid empty state for every field
+                    m_Segment = static_cast<SegmentHeader*>(mapped);
+                    if(create)
+                        m_Segment->Capacity = capacity;
+                    m_Data = reinterpret_cast<uint8_t*>(m_Segment + 1);
+
+                    m_Side = create ? 0 : 1;
+                    m_ThrWaiter = std::thread([this]() { WaiterLoop(); });
+                }
+
+                ~Impl()
+                {
+                    Close();
+                    {
+                        std::scoped_lock lock(m_MuxWaiter);
+                        m_bRunning = false;
+                    }
+                    m_CvWaiter.notify_one();
+                    Wake(m_Side);
+                    if(m_ThrWaiter.joinable())
+                        m_ThrWaiter.join();
+
+                    munmap(m_Segment, m_MappedSize);
+                    if(m_bCreator)
+                        shm_unlink(("/fumbly-" + m_Name).c_str());
+                }
+
+                const std::string& Name() const { return m_Name; }
+
+                bool IsClosed() const { return m_bLocalClosed || m_Segment->Closed.load() != 0; }
+
+                void Close()
+                {
+                    if(m_bLocalClosed.exchange(true))
+                        return;
+
+                    m_Segment->Closed.store(1);
+                    RingPeer();
+                    Wake(m_Side);
+                }
+
+                // Copy as much as possible, returns bytes moved (0 means op has to wait)
+                size_t Transfer(bool read, const std::vector<asio::mutable_buffer>& buffers)
+                {
+                    // Creator writes ring 0 and reads ring 1
+                    RingHeader& ring = m_Segment->Rings[read ? 1 - m_Side : m_Side];
+                    uint8_t* data = m_Data + (read ? 1 - m_Side : m_Side) * m_Segment->Capacity;
+                    uint64_t capacity = m_Segment->Capacity;
+
+                    uint64_t head = ring.Head.load(read ? std::memory_order_acquire : std::memory_order_relaxed);
+                    uint64_t tail = ring.Tail.load(read ? std::memory_order_relaxed : std::memory_order_acquire);
+                    uint64_t available = read ? head - tail : capacity - (head - tail);
+                    if(available == 0)
+                        return 0;
+
+                    // Ring region may wrap around the end of the mapping
+                    uint64_t pos = (read ? tail : head) & (capacity - 1);
+                    uint64_t first = std::min<uint64_t>(available, capacity - pos);
+                    size_t moved;
+                    if(read)
+                    {
+                        std::array<asio::const_buffer, 2> ringRegion{asio::const_buffer(data + pos, first), asio::const_buffer(data, available - first)};
+                        moved = asio::buffer_copy(buffers, ringRegion);
+                        ring.Tail.store(tail + moved, std::memory_order_release);
+                    }
+                    else
+                    {
+                        std::array<asio::mutable_buffer, 2> ringRegion{asio::mutable_buffer(data + pos, first), asio::mutable_buffer(data, available - first)};
+                        moved = asio::buffer_copy(ringRegion, buffers);
+                        ring.Head.store(head + moved, std::memory_order_release);
+                    }
+
+                    if(moved > 0)
+                        RingPeer();
+                    return moved;
+                }
+
+                // Hand an op that could not progress to the waiter thread
+                void Park(bool read, PendingOp op, executor_type executor, std::function<void(bool, PendingOp)> retry)
+                {
+                    {
+                        std::scoped_lock lock(m_MuxWaiter);
+                        m_Parked[read ? 0 : 1] = std::move(op);
+                        m_bParked[read ? 0 : 1] = true;
+                        m_Executor = executor;
+                        m_FnRetry = std::move(retry);
+                    }
+                    m_CvWaiter.notify_one();
+
+                    // Waiter may already be asleep on the futex for the other direction, make it look again
+                    m_Segment->Doorbell[m_Side].fetch_add(1);
+                    if(m_Segment->Sleeping[m_Side].load() != 0)
+                        Wake(m_Side);
+                }
+
+                bool CanProgress(bool read) const
+                {
+                    const RingHeader& ring = m_Segment->Rings[read ? 1 - m_Side : m_Side];
+                    uint64_t used = ring.Head.load(std::memory_order_acquire) - ring.Tail.load(std::memory_order_acquire);
+                    return read ? used > 0 : used < m_Segment->Capacity;
+                }
+
+            private:
+                void RingPeer()
+                {
+                    uint32_t peer = 1 - m_Side;
+                    m_Segment->Doorbell[peer].fetch_add(1);
+                    if(m_Segment->Sleeping[peer].load() != 0)
+                        Wake(peer);
+                }
+
+                void Wake(uint32_t side)
+                {
+                    syscall(SYS_futex, &m_Segment->Doorbell[side], FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+                }
+
+                // Sleeps on the futex while parked ops cannot progress, then posts them back to the io thread
+                void WaiterLoop()
+                {
+                    std::unique_lock<std::mutex> ul(m_MuxWaiter);
+                    while(true)
+                    {
+                        m_CvWaiter.wait(ul, [this]() { return !m_bRunning || m_bParked[0] || m_bParked[1]; });
+                        if(!m_bRunning)
+                            break;
+
+                        uint32_t seq = m_Segment->Doorbell[m_Side].load();
+                        bool bParkedRead = m_bParked[0];
+                        bool bParkedWrite = m_bParked[1];
+                        auto isReady = [&]() { return IsClosed() || (bParkedRead && CanProgress(true)) || (bParkedWrite && CanProgress(false)); };
+                        if(!isReady())
+                        {
+                            ul.unlock();
+                            m_Segment->Sleeping[m_Side].store(1);
+
+                            // Recheck after announcing we sleep, the futex returns at once if the doorbell moved since
+                            if(!isReady())
+                                syscall(SYS_futex, &m_Segment->Doorbell[m_Side], FUTEX_WAIT, seq, nullptr, nullptr, 0);
+
+                            m_Segment->Sleeping[m_Side].store(0);
+                            ul.lock();
+                            continue;
+                        }
+
+                        for(int i = 0; i < 2; i++)
+                        {
+                            if(m_bParked[i] && (IsClosed() || CanProgress(i == 0)))
+                            {
+                                m_bParked[i] = false;
+                                asio::post(*m_Executor, [retry = m_FnRetry, read = i == 0, op = std::make_shared<PendingOp>(std::move(m_Parked[i]))]() {
+                                    retry(read, std::move(*op));
+                                });
+                            }
+                        }
+                    }
+                }
+
+            private:
+                std::string m_Name;
+                bool m_bCreator = false;
+                uint32_t m_Side = 0;
+
+                SegmentHeader* m_Segment = nullptr;
+                uint8_t* m_Data = nullptr;
+                size_t m_MappedSize = 0;
+                std::atomic<bool> m_bLocalClosed = false;
+
+                // At most one read and one write are outstanding (the Connection read/write loops)
+                std::thread m_ThrWaiter;
+                std::mutex m_MuxWaiter;
+                std::condition_variable m_CvWaiter;
+                bool m_bRunning = true;
+                PendingOp m_Parked[2];
+                bool m_bParked[2] = {false, false};
+                std::optional<executor_type> m_Executor;
+                std::function<void(bool, PendingOp)> m_FnRetry;
+            };
+
+            template<typename Iterator, typename Handler>
+            void Start(bool read, Iterator begin, Iterator end, Handler&& handler)
+            {
+                PendingOp op;
+                for(auto it = begin; it != end; ++it)
+                {
+                    // Write buffers are const, they are only ever read from
+                    asio::const_buffer b(*it);
+                    op.Buffers.emplace_back(const_cast<void*>(b.data()), b.size());
+                }
+                op.Handler = std::make_unique<CompletionImpl<std::decay_t<Handler>>>(std::move(handler));
+                Progress(m_Impl, m_Executor, read, std::move(op), false);
+            }
+
+            // Runs on the io thread, completes the op if the ring allows otherwise spins a little then parks it.
+            // Does not touch the socket, which may have been moved or destroyed by the time a parked op is retried.
+            // With bInline the handler is called right here, only for retries which already run as a posted handler
+            static void Progress(const std::shared_ptr<Impl>& impl, executor_type executor, bool read, PendingOp op, bool bInline)
+            {
+                auto complete = [&](asio::error_code ec, size_t length) {
+                    if(bInline)
+                        op.Handler->Invoke(ec, length);
+                    else
+                        op.Handler->Post(executor, ec, length);
+                };
+
+                if(!impl)
+                {
+                    complete(asio::error::bad_descriptor, 0);
+                    return;
+                }
+
+                // Spinning only pays off when the peer runs on another core
+                static const uint32_t nSpins = std::thread::hardware_concurrency() > 1 ? SpinCount : 0;
+                for(uint32_t spin = 0; spin <= nSpins; spin++)
+                {
+                    size_t moved = impl->Transfer(read, op.Buffers);
+                    if(moved > 0)
+                    {
+                        complete(asio::error_code(), moved);
+                        return;
+                    }
+                    if(impl->IsClosed())
+                    {
+                        complete(read ? asio::error_code(asio::error::eof) : asio::error_code(asio::error::broken_pipe), 0);
+                        return;
+                    }
+                }
+
+                // The retry only holds the link weakly, once its socket is gone the op is aborted like asio does on destroy
+                std::weak_ptr<Impl> weakImpl = impl;
+                impl->Park(read, std::move(op), executor, [weakImpl, executor](bool read, PendingOp op) {
+                    std::shared_ptr<Impl> impl = weakImpl.lock();
+                    if(!impl)
+                    {
+                        op.Handler->Invoke(asio::error::operation_aborted, 0);
+                        return;
+                    }
+                    Progress(impl, executor, read, std::move(op), true);
+                });
+            }
+
+        private:
+            executor_type m_Executor;
+
+            // Shared with parked ops only through weak pointers
+            std::shared_ptr<Impl> m_Impl;
+        };
+    };
+}
+#endif
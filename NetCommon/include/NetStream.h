@@ -0,0 +1,157 @@
+#pragma once
+
+#include "NetCommon.h"
+#include "NetMessage.h"
+
+namespace Fumbly {
+    // Limits on the frames a connection reads and writes, and how its outbound lanes share the link
+    struct FrameSettings
+    {
+        // Frames claiming a larger body are treated as a protocol error and the connection is closed
+        uint32_t MaxFrameSize = 1 << 20;
+
+        // Streams are sent in chunks of this many payload bytes, one chunk per turn of the write loop
+        uint32_t StreamChunkSize = 64 << 10;
+
+        // Incoming streams allowed to be in progress at once on a connection
+        uint32_t MaxIncomingStreams = 64;
+
+        // Socket reads land in a buffer of this size, every complete frame in it is dispatched without another read.
+        // Larger frames are read straight into their body
+        uint32_t ReceiveBufferSize = 16 << 10;
+
+        // Queued messages are written together in one gather write of up to this many bytes
+        uint32_t WriteBatchBytes = 64 << 10;
+
+        // Share of the link per Priority lane, a lane waiting to write gets LaneWeights * LaneQuantum bytes per round.
+        // Weight 0 is strict priority, such a lane is always written before the others
+        std::array<uint32_t, PriorityCount> LaneWeights{0, 8, 4, 1};
+        uint32_t LaneQuantum = 16 << 10;
+    };
+
+    // Leads the body of every frame flagged MessageFlags::StreamChunk, the payload bytes follow it
+    struct StreamChunkHeader
+    {
+        uint32_t StreamID;
+        uint32_t Reserved;
+        uint64_t Offset;
+        uint64_t TotalSize;
+    };
+
+    // One piece of an incoming stream as handed to a stream handler. Data points into the connection's
+    // read buffer and is only valid during the call
+    template<typename T>
+    struct StreamChunk
+    {
+        uint32_t ConnectionID = 0;
+        uint32_t StreamID = 0;
+        T Id{};
+        uint64_t Offset = 0;
+        uint64_t TotalSize = 0;
+        const uint8_t* Data = nullptr;
+        size_t Size = 0;
+
+        // Connection closed before the stream completed, no more chunks will follow
+        bool Aborted = false;
+
+        bool IsLast() const { return !Aborted && Offset + Size == TotalSize; }
+    };
+
+    // Stream handler that writes every stream straight into its own file as the chunks arrive,
+    // memory use is independent of the stream size. Safe to share between io threads
+    template<typename T>
+    class StreamFileSink
+    {
+    public:
+        // Picks the file for a new stream, returning an empty path skips the stream
+        using PathFunction = std::function<std::string(const StreamChunk<T>&)>;
+
+        // Called once the stream's file is complete, or with bComplete false after the partial file was removed
+        using DoneFunction = std::function<void(const StreamChunk<T>&, const std::string&, bool bComplete)>;
+
+        StreamFileSink(PathFunction fnPath, DoneFunction fnDone = {}, uint64_t nMaxStreamSize = uint64_t(4) << 30)
+            :m_FnPath(std::move(fnPath)), m_FnDone(std::move(fnDone)), m_MaxStreamSize(nMaxStreamSize)
+        {
+        }
+
+        ~StreamFileSink()
+        {
+            for(auto& [key, file] : m_Files)
+            {
+                fclose(file.File);
+                std::remove(file.Path.c_str());
+            }
+        }
+
+        StreamFileSink(const StreamFileSink& other) = delete;
+        void operator=(const StreamFileSink& other) = delete;
+
+    public:
+        void operator()(const StreamChunk<T>& chunk)
+        {
+            std::string path;
+            bool bComplete = false;
+            {
+                std::scoped_lock lock(m_MuxFiles);
+                uint64_t key = (uint64_t(chunk.ConnectionID) << 32) | chunk.StreamID;
+                auto it = m_Files.find(key);
+
+                if(it == m_Files.end() && chunk.Offset == 0 && !chunk.Aborted)
+                {
+                    if(chunk.TotalSize > m_MaxStreamSize)
+                    {
+                        FUMBLY_LOG_WARN("[", chunk.ConnectionID, "] Stream ", chunk.StreamID, " of ", chunk.TotalSize, " bytes exceeds sink limit, skipped");
+                        return;
+                    }
+
+                    std::string newPath = m_FnPath(chunk);
+                    if(newPath.empty())
+                        return;
+
+                    FILE* file = fopen(newPath.c_str(), "wb");
+                    if(!file)
+                    {
+                        FUMBLY_LOG_WARN("[", chunk.ConnectionID, "] Stream ", chunk.StreamID, " could not open ", newPath);
+                        return;
+                    }
+                    it = m_Files.emplace(key, OpenFile{file, std::move(newPath)}).first;
+                }
+
+                // Skipped stream
+                if(it == m_Files.end())
+                    return;
+
+                bool bFailed = chunk.Aborted || (chunk.Size > 0 && fwrite(chunk.Data, 1, chunk.Size, it->second.File) != chunk.Size);
+                if(!bFailed && !chunk.IsLast())
+                    return;
+
+                fclose(it->second.File);
+                path = std::move(it->second.Path);
+                m_Files.erase(it);
+
+                bComplete = !bFailed;
+                if(!bComplete)
+                    std::remove(path.c_str());
+            }
+
+            // Outside the lock so the callback may feed the sink again
+            if(m_FnDone)
+                m_FnDone(chunk, path, bComplete);
+        }
+
+    private:
+        struct OpenFile
+        {
+            FILE* File;
+            std::string Path;
+        };
+
+        PathFunction m_FnPath;
+        DoneFunction m_FnDone;
+        uint64_t m_MaxStreamSize;
+
+        // Streams being written keyed by connection id and stream id
+        std::unordered_map<uint64_t, OpenFile> m_Files;
+        std::mutex m_MuxFiles;
+    };
+}
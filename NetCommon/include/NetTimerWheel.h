@@ -0,0 +1,165 @@
+#pragma once
+
+#include "NetCommon.h"
+
+namespace Fumbly {
+    // Intrusive timer owned by the object it times (i.e a connection), linking it into a wheel allocates nothing
+    struct TimerNode
+    {
+        TimerNode* Prev = nullptr;
+        TimerNode* Next = nullptr;
+        uint64_t Expiry = 0;
+        std::function<void()> Callback;
+
+        bool IsLinked() const { return Prev != nullptr; }
+    };
+
+    // Hierarchical timing wheel driven by a single steady_timer on one io_context.
+    // Schedule/Cancel are O(1), each tick only touches the slot that is due (plus an occasional cascade),
+    // so thousands of connection timeouts cost one asio timer per io thread instead of one each.
+    // Not thread safe, must only be used from the thread running the io_context
+    class TimerWheel
+    {
+    public:
+        static constexpr uint32_t SlotBits = 6;
+        static constexpr uint32_t Slots = 1 << SlotBits;
+        static constexpr uint32_t Levels = 4;
+
+        TimerWheel(asio::io_context& asioContext, std::chrono::milliseconds tick = std::chrono::milliseconds(100))
+            :m_Ticker(asioContext), m_Tick(tick)
+        {
+            for(auto& level : m_Wheel)
+            {
+                for(auto& slot : level)
+                {
+                    slot.Prev = &slot;
+                    slot.Next = &slot;
+                }
+            }
+        }
+
+        TimerWheel(const TimerWheel& other) = delete;
+        void operator=(const TimerWheel& other) = delete;
+
+    public:
+        // ASYNC - Prime context with the tick loop
+        void Start()
+        {
+            m_NextTick = std::chrono::steady_clock::now() + m_Tick;
+            WaitForTick();
+        }
+
+        void Stop()
+        {
+            m_Ticker.cancel();
+        }
+
+        // (Re)arm node to fire after delay, rounded up to whole ticks
+        void Schedule(TimerNode& node, std::chrono::milliseconds delay)
+        {
+            Cancel(node);
+            uint64_t ticks = (delay.count() + m_Tick.count() - 1) / m_Tick.count();
+            node.Expiry = m_CurrentTick + std::max<uint64_t>(1, ticks);
+            Insert(node);
+        }
+
+        void Cancel(TimerNode& node)
+        {
+            if(node.IsLinked())
+            {
+                node.Prev->Next = node.Next;
+                node.Next->Prev = node.Prev;
+                node.Prev = nullptr;
+                node.Next = nullptr;
+            }
+        }
+
+        std::chrono::milliseconds TickDuration() const { return m_Tick; }
+
+        // Advance the wheel by one tick firing all expired timers, normally called by the tick loop
+        void Advance()
+        {
+            m_CurrentTick++;
+
+            // Move timers of the higher level slot that is now due down into finer slots
+            for(uint32_t level = 1; level < Levels; level++)
+            {
+                if(SlotIndex(m_CurrentTick, level - 1) != 0)
+                    break;
+                Cascade(level, SlotIndex(m_CurrentTick, level));
+            }
+
+            TimerNode& slot = m_Wheel[0][SlotIndex(m_CurrentTick, 0)];
+            while(slot.Next != &slot)
+            {
+                // Unlink before calling so the callback is free to reschedule the node
+                TimerNode* node = slot.Next;
+                Cancel(*node);
+                node->Callback();
+            }
+        }
+
+    private:
+        static uint32_t SlotIndex(uint64_t tick, uint32_t level)
+        {
+            return static_cast<uint32_t>((tick >> (level * SlotBits)) & (Slots - 1));
+        }
+
+        void Insert(TimerNode& node)
+        {
+            uint64_t delta = node.Expiry > m_CurrentTick ? node.Expiry - m_CurrentTick : 0;
+
+            // Find the finest level whose range covers the delay, delays past the last level are clamped to it
+            uint32_t level = 0;
+            while(level < Levels - 1 && delta >= (uint64_t(1) << ((level + 1) * SlotBits)))
+                level++;
+
+            uint64_t expiry = node.Expiry;
+            if(level == Levels - 1 && delta >= (uint64_t(1) << (Levels * SlotBits)))
+                expiry = m_CurrentTick + (uint64_t(1) << (Levels * SlotBits)) - 1;
+
+            TimerNode& slot = m_Wheel[level][SlotIndex(expiry, level)];
+            node.Next = &slot;
+            node.Prev = slot.Prev;
+            slot.Prev->Next = &node;
+            slot.Prev = &node;
+        }
+
+        void Cascade(uint32_t level, uint32_t index)
+        {
+            TimerNode& slot = m_Wheel[level][index];
+            while(slot.Next != &slot)
+            {
+                TimerNode* node = slot.Next;
+                Cancel(*node);
+                Insert(*node);
+            }
+        }
+
+        // ASYNC - Tick loop, catches up if the io thread was busy for longer than a tick
+        void WaitForTick()
+        {
+            m_Ticker.expires_at(m_NextTick);
+            m_Ticker.async_wait([this](std::error_code ec) {
+                if(ec) return;
+
+                auto now = std::chrono::steady_clock::now();
+                while(m_NextTick <= now)
+                {
+                    Advance();
+                    m_NextTick += m_Tick;
+                }
+                WaitForTick();
+            });
+        }
+
+    private:
+        // Each slot is the sentinel of a circular list of timers
+        TimerNode m_Wheel[Levels][Slots];
+        uint64_t m_CurrentTick = 0;
+
+        asio::steady_timer m_Ticker;
+        std::chrono::milliseconds m_Tick;
+        std::chrono::steady_clock::time_point m_NextTick;
+    };
+}
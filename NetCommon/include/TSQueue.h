@@ -2,6 +2,10 @@
 #include <thread>
 #include <mutex>
 #include <deque>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
 
 namespace Fumbly {
     template<typename T>
@@ -26,22 +30,36 @@ namespace Fumbly {
             return deqQue.back();
         }
 
-        const T& Count()
+        size_t Count()
         {
             std::scoped_lock lock(muxQueue);
-            return deqQue.size()
+            return deqQue.size();
         }
 
         void Clear()
         {
             std::scoped_lock lock(muxQueue);
             return deqQue.clear();
-        } 
+        }
 
         void PushFront(const T& item)
         {
-            std::scoped_lock(muxQueue);
-            deqQue.emplace_front(std::move(item));
+            {
+                std::scoped_lock lock(muxQueue);
+                deqQue.push_front(item);
+            }
+
+            // Signal condition variable to wake up
+            std::unique_lock<std::mutex> ul(muxBlocking);
+            cvBlocking.notify_one();
+        }
+
+        void PushFront(T&& item)
+        {
+            {
+                std::scoped_lock lock(muxQueue);
+                deqQue.push_front(std::move(item));
+            }
 
             // Signal condition variable to wake up
             std::unique_lock<std::mutex> ul(muxBlocking);
@@ -66,8 +84,23 @@ namespace Fumbly {
 
         void PushBack(const T& item)
         {
-            std::scoped_lock(muxQueue);
-            deqQue.emplace_back(std::move(item));
+            {
+                std::scoped_lock lock(muxQueue);
+                deqQue.push_back(item);
+            }
+
+            // Signal condition variable to wake up
+            std::unique_lock<std::mutex> ul(muxBlocking);
+            cvBlocking.notify_one();
+        }
+
+        // Moves item in, messages pushed from the io threads never copy their body
+        void PushBack(T&& item)
+        {
+            {
+                std::scoped_lock lock(muxQueue);
+                deqQue.push_back(std::move(item));
+            }
 
             // Signal condition variable to wake up
             std::unique_lock<std::mutex> ul(muxBlocking);
@@ -76,20 +109,51 @@ namespace Fumbly {
 
         bool Empty()
         {
-            std::scoped_lock(muxQueue);
+            std::scoped_lock lock(muxQueue);
             return deqQue.empty();
         }
 
         void Wait()
         {
-            // Run while deqQue is empty
-            while(Empty())
+            // Blocking lock is held while checking so a push cannot signal between the check and the wait
+            std::unique_lock<std::mutex> ul(muxBlocking);
+
+            // wait until condition has been signalled by push functions
+            cvBlocking.wait(ul, [this]() { return !Empty(); });
+        }
+
+        // Same as Wait but gives up after timeout, returns true if queue has items
+        template<typename Rep, typename Period>
+        bool WaitFor(const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::unique_lock<std::mutex> ul(muxBlocking);
+            return cvBlocking.wait_for(ul, timeout, [this]() { return !Empty(); });
+        }
+
+        // Moves up to nMaxItems out of the queue under a single lock then passes each to handler, returns number of items handled
+        template<typename Handler>
+        size_t Drain(Handler&& handler, size_t nMaxItems = -1)
+        {
+            std::deque<T> batch;
             {
-                std::unique_lock<std::mutex> ul(muxBlocking);
+                std::scoped_lock lock(muxQueue);
+                if(nMaxItems >= deqQue.size())
+                {
+                    batch.swap(deqQue);
+                }
+                else
+                {
+                    std::move(deqQue.begin(), deqQue.begin() + nMaxItems, std::back_inserter(batch));
+                    deqQue.erase(deqQue.begin(), deqQue.begin() + nMaxItems);
+                }
+            }
 
-                // wait until condition has been signalled by push or pop functions
-                cvBlocking.wait(ul);
+            // Handler runs without the lock so producers are never blocked by message processing
+            for(auto& item : batch)
+            {
+                handler(item);
             }
+            return batch.size();
         }
 
     private:
@@ -99,4 +163,4 @@ namespace Fumbly {
         std::condition_variable cvBlocking;
         std::mutex muxBlocking;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,39 @@
+#include <FumblyNet.h>
+
+// Replays the incoming traffic of a capture (ServerSettings::CapturePath) against a running server.
+// Message ids are replayed as raw 32 bit values, matching servers whose message enum is 32 bits wide.
+//     NetReplay <capture file> <host> <port> [speed, 1 = recorded timing, 0 = as fast as possible]
+int main(int argc, char** argv)
+{
+#if defined(FUMBLY_HAS_CAPTURE)
+    if(argc < 4)
+    {
+        std::cerr << "usage: " << argv[0] << " <capture file> <host> <port> [speed]\n";
+        return 1;
+    }
+
+    const std::string host = argv[2];
+    const uint16_t port = static_cast<uint16_t>(std::stoi(argv[3]));
+    const double speed = argc > 4 ? std::stod(argv[4]) : 1.0;
+
+    try
+    {
+        auto result = Fumbly::CaptureReplay<uint32_t>::Run(argv[1],
+            [&](Fumbly::ClientInterface<uint32_t>& client) { return client.Connect(host, port); }, speed);
+
+        double seconds = std::chrono::duration<double>(result.Elapsed).count();
+        std::cout << "Replayed " << result.nFrames << " frames (" << result.nBytes << " bytes) over "
+            << result.nConnections << " connections in " << seconds << "s: "
+            << (seconds > 0.0 ? result.nFrames / seconds : 0.0) << " frames/s\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Replay failed: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+#else
+    std::cerr << "Traffic capture is not supported on this platform\n";
+    return 1;
+#endif
+}
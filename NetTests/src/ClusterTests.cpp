@@ -0,0 +1,124 @@
+#include <FumblyNet.h>
+
+// Cluster directory tests, run by ctest
+//     NetClusterTests directory    clients leave every node's directory when they close, without any traffic to them
+//     NetClusterTests links        a restarted peer leaves one inbound link, a stopped peer's clients are forgotten
+
+static int s_nFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            s_nFailures++; \
+        } \
+    } while(0)
+
+enum class TestMsg : uint32_t
+{
+    Ping
+};
+
+class TestNode : public Fumbly::ClusterServer<TestMsg>
+{
+public:
+    using Fumbly::ClusterServer<TestMsg>::ClusterServer;
+
+protected:
+    bool OnClientConnect(std::shared_ptr<Fumbly::Connection<TestMsg>> client) override
+    {
+        return true;
+    }
+};
+
+// Node id links to every other node of a two node cluster, ports are offset by base so suites do not collide
+static std::unique_ptr<TestNode> StartNode(uint32_t id, uint16_t base)
+{
+    Fumbly::ClusterSettings cluster;
+    cluster.NodeID = id;
+    cluster.BusPort = uint16_t(base + 10 + id);
+    cluster.RetryInterval = std::chrono::milliseconds(100);
+    cluster.Peers.push_back({1 - id, "127.0.0.1", uint16_t(base + 10 + (1 - id))});
+
+    auto node = std::make_unique<TestNode>(uint16_t(base + id), cluster);
+    CHECK(node->Start());
+    return node;
+}
+
+// Polls until condition holds or timeout expires
+template<typename Condition>
+static bool WaitUntil(Condition&& condition, std::chrono::milliseconds timeout = std::chrono::milliseconds(3000))
+{
+    auto tEnd = std::chrono::steady_clock::now() + timeout;
+    while(!condition())
+    {
+        if(std::chrono::steady_clock::now() > tEnd)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+// Client ids are the node id in the top byte on top of the usual counter
+static uint32_t FirstClientID(uint32_t nodeID)
+{
+    return (nodeID << 24) + 10000;
+}
+
+static void TestDirectory()
+{
+    const uint16_t base = 60300;
+    auto a = StartNode(0, base);
+    auto b = StartNode(1, base);
+
+    Fumbly::ClientInterface<TestMsg> client;
+    CHECK(client.Connect("127.0.0.1", base + 1));
+    CHECK(WaitUntil([&]() { return a->FindClient(FirstClientID(1)) == std::optional<uint32_t>(1); }));
+
+    // Nothing is sent to the client, only its close can take it out of the directories
+    client.Disconnect();
+    CHECK(WaitUntil([&]() { return !b->FindClient(FirstClientID(1)); }));
+    CHECK(WaitUntil([&]() { return !a->FindClient(FirstClientID(1)); }));
+    CHECK(b->ConnectionCount() == 0);
+
+    Fumbly::Message<TestMsg> msg;
+    msg.Header.Id = TestMsg::Ping;
+    CHECK(!a->MessageClusterClient(FirstClientID(1), msg));
+}
+
+static void TestLinks()
+{
+    const uint16_t base = 60320;
+    auto a = StartNode(0, base);
+
+    for(int i = 0; i < 3; i++)
+    {
+        auto b = StartNode(1, base);
+        Fumbly::ClientInterface<TestMsg> client;
+        CHECK(client.Connect("127.0.0.1", base + 1));
+
+        // The link of the previous run of b is closed and replaced, never kept next to the new one
+        CHECK(WaitUntil([&]() { return a->FindClient(FirstClientID(1)).has_value(); }));
+        CHECK(WaitUntil([&]() { return a->InboundLinkCount() == 1; }));
+
+        // b goes away without saying goodbye for its client, a forgets the clients b had reported
+        b.reset();
+        CHECK(WaitUntil([&]() { return !a->FindClient(FirstClientID(1)); }));
+        CHECK(WaitUntil([&]() { return a->InboundLinkCount() == 0; }));
+        client.Disconnect();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    const std::string suite = argc > 1 ? argv[1] : "";
+    if(suite.empty() || suite == "directory")
+        TestDirectory();
+    if(suite.empty() || suite == "links")
+        TestLinks();
+
+    printf("%s: %d failures\n", suite.empty() ? "all" : suite.c_str(), s_nFailures);
+    return s_nFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+#include <FumblyNet.h>
+
+// Timer wheel and connection timeout tests, run by ctest
+//     NetTests wheel       exact tick firing across cascades, cancel/reschedule from callbacks
+//     NetTests timeouts    handshake timeout of a silent socket, idle timeout with and without heartbeats, timed out
+//                          clients leave the server's list with a single OnClientDisconnect
+
+static int s_nFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            s_nFailures++; \
+        } \
+    } while(0)
+
+enum class TestMsg : uint32_t
+{
+    Ping
+};
+
+class TestServer : public Fumbly::ServerInterface<TestMsg>
+{
+public:
+    TestServer(uint16_t nPort, const Fumbly::ServerSettings& settings) : Fumbly::ServerInterface<TestMsg>(nPort, settings)
+    {
+    }
+
+    std::atomic<int> nDisconnects = 0;
+
+protected:
+    bool OnClientConnect(std::shared_ptr<Fumbly::Connection<TestMsg>> client) override
+    {
+        return true;
+    }
+
+    void OnClientDisconnect(std::shared_ptr<Fumbly::Connection<TestMsg>> client) override
+    {
+        nDisconnects++;
+    }
+};
+
+// Wheel is driven by hand, its io context never runs. One tick is one millisecond so delays are in ticks
+static void TestExactTicks()
+{
+    asio::io_context context;
+    Fumbly::TimerWheel wheel(context, std::chrono::milliseconds(1));
+
+    // Start off a level boundary so cascades do not line up with the delays
+    for(int i = 0; i < 37; i++)
+        wheel.Advance();
+
+    // Either side of every level boundary, up to the last level
+    const std::vector<uint64_t> delays = {1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 70000, 262143, 262144, 262145, 300000};
+    std::vector<Fumbly::TimerNode> nodes(delays.size());
+    std::vector<uint64_t> fired(delays.size(), 0);
+    uint64_t nTick = 0;
+    for(size_t i = 0; i < delays.size(); i++)
+    {
+        nodes[i].Callback = [&, i]() { fired[i] = nTick; };
+        wheel.Schedule(nodes[i], std::chrono::milliseconds(delays[i]));
+    }
+
+    for(nTick = 1; nTick <= delays.back() + 1; nTick++)
+        wheel.Advance();
+
+    for(size_t i = 0; i < delays.size(); i++)
+    {
+        if(fired[i] != delays[i])
+            fprintf(stderr, "timer of %llu ticks fired at %llu\n", (unsigned long long)delays[i], (unsigned long long)fired[i]);
+        CHECK(fired[i] == delays[i]);
+        CHECK(!nodes[i].IsLinked());
+    }
+}
+
+static void TestCallbackRearm()
+{
+    asio::io_context context;
+    Fumbly::TimerWheel wheel(context, std::chrono::milliseconds(1));
+
+    // First and second are due on the same tick, the first one cancels the second and reschedules itself
+    Fumbly::TimerNode first, second, zero;
+    std::vector<uint64_t> firstFired, secondFired, zeroFired;
+    uint64_t nTick = 0;
+    first.Callback = [&]() {
+        firstFired.push_back(nTick);
+        wheel.Cancel(second);
+        if(firstFired.size() < 3)
+            wheel.Schedule(first, std::chrono::milliseconds(70));
+    };
+    second.Callback = [&]() { secondFired.push_back(nTick); };
+
+    // A zero delay from inside a callback must wait for the next tick, not fire again in the same Advance
+    zero.Callback = [&]() {
+        zeroFired.push_back(nTick);
+        if(zeroFired.size() < 3)
+            wheel.Schedule(zero, std::chrono::milliseconds(0));
+    };
+
+    wheel.Schedule(first, std::chrono::milliseconds(10));
+    wheel.Schedule(second, std::chrono::milliseconds(10));
+    wheel.Schedule(zero, std::chrono::milliseconds(5));
+
+    for(nTick = 1; nTick <= 300; nTick++)
+        wheel.Advance();
+
+    CHECK((firstFired == std::vector<uint64_t>{10, 80, 150}));
+    CHECK(secondFired.empty());
+    CHECK((zeroFired == std::vector<uint64_t>{5, 6, 7}));
+    CHECK(!first.IsLinked() && !second.IsLinked() && !zero.IsLinked());
+
+    // Rescheduling a linked node moves it instead of adding it twice
+    int nCount = 0;
+    first.Callback = [&]() { nCount++; };
+    wheel.Schedule(first, std::chrono::milliseconds(5));
+    wheel.Schedule(first, std::chrono::milliseconds(100));
+    for(int i = 0; i < 200; i++)
+    {
+        wheel.Advance();
+        if(i == 50)
+            CHECK(nCount == 0);
+    }
+    CHECK(nCount == 1);
+}
+
+// Connects and reads the server's handshake but never answers it
+static void TestHandshakeTimeout()
+{
+    const uint16_t port = 60200;
+    Fumbly::ServerSettings settings;
+    settings.Timeouts.Handshake = std::chrono::milliseconds(300);
+    settings.TimerTick = std::chrono::milliseconds(10);
+    TestServer server(port, settings);
+    CHECK(server.Start());
+
+    asio::io_context context;
+    asio::ip::tcp::socket silent(context);
+    asio::error_code ec;
+    silent.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), port), ec);
+    CHECK(!ec);
+
+    auto tStart = std::chrono::steady_clock::now();
+    uint64_t nHandshake = 0;
+    asio::read(silent, asio::buffer(&nHandshake, sizeof(nHandshake)), ec);
+    CHECK(!ec);
+
+    // Server closes the socket once the handshake timeout expires
+    asio::read(silent, asio::buffer(&nHandshake, sizeof(nHandshake)), ec);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+    CHECK(ec == asio::error::eof || ec == asio::error::connection_reset);
+    CHECK(ms >= 250 && ms < 2000);
+
+    // Removal is posted right after the close
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(server.ConnectionCount() == 0);
+    CHECK(server.nDisconnects == 1);
+
+    server.Stop();
+}
+
+// The server does not send heartbeats itself, so only the client's heartbeats keep its idle timer from expiring
+static void TestIdleTimeout()
+{
+    const uint16_t port = 60201;
+    Fumbly::ServerSettings settings;
+    settings.Timeouts.Idle = std::chrono::milliseconds(500);
+    settings.Timeouts.Heartbeat = std::chrono::milliseconds(0);
+    settings.TimerTick = std::chrono::milliseconds(10);
+    TestServer server(port, settings);
+    CHECK(server.Start());
+
+    Fumbly::TimeoutSettings heartbeats;
+    heartbeats.Idle = std::chrono::milliseconds(0);
+    heartbeats.Heartbeat = std::chrono::milliseconds(100);
+    Fumbly::ClientInterface<TestMsg> beating(heartbeats);
+
+    Fumbly::TimeoutSettings silent = heartbeats;
+    silent.Heartbeat = std::chrono::milliseconds(0);
+    Fumbly::ClientInterface<TestMsg> quiet(silent);
+
+    CHECK(beating.Connect("127.0.0.1", port));
+    CHECK(quiet.Connect("127.0.0.1", port));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(beating.IsConnected());
+    CHECK(quiet.IsConnected());
+    CHECK(server.ConnectionCount() == 2);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1300));
+    CHECK(beating.IsConnected());
+    CHECK(!quiet.IsConnected());
+
+    // The timed out client is gone from the server without any traffic to it, and a broadcast does not report it again
+    CHECK(server.ConnectionCount() == 1);
+    CHECK(server.nDisconnects == 1);
+    Fumbly::Message<TestMsg> msg;
+    msg.Header.Id = TestMsg::Ping;
+    server.MessageAllClients(msg, nullptr);
+    CHECK(server.ConnectionCount() == 1);
+    CHECK(server.nDisconnects == 1);
+
+    beating.Disconnect();
+    quiet.Disconnect();
+    server.Stop();
+}
+
+int main(int argc, char** argv)
+{
+    Fumbly::Logger::Get().SetOutput(stderr);
+
+    const std::string suite = argc > 1 ? argv[1] : "";
+    if(suite.empty() || suite == "wheel")
+    {
+        TestExactTicks();
+        TestCallbackRearm();
+    }
+    if(suite.empty() || suite == "timeouts")
+    {
+        TestHandshakeTimeout();
+        TestIdleTimeout();
+    }
+
+    printf("%s: %d failures\n", suite.empty() ? "all" : suite.c_str(), s_nFailures);
+    return s_nFailures == 0 ? 0 : 1;
+}